@@ -20,10 +20,18 @@ import android.os.Debug
 import android.util.Log
 import androidx.test.ext.junit.runners.AndroidJUnit4
 import androidx.test.platform.app.InstrumentationRegistry
+import java.io.File
+import java.io.IOException
+import java.nio.ByteBuffer
+import java.util.concurrent.atomic.AtomicBoolean
+import java.util.concurrent.atomic.AtomicInteger
 import kotlinx.coroutines.Job
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.test.runTest
+import org.junit.Assert.assertArrayEquals
 import org.junit.Assert.assertEquals
+import org.junit.Assert.assertThrows
+import org.junit.Assume.assumeTrue
 import org.junit.Test
 import org.junit.runner.RunWith
 
@@ -73,6 +81,514 @@ class KVTest {
         emoKV.close()
     }
 
+    @Test
+    fun kv_delete_churn() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_churn").deleteRecursively()
+        val emoKV = EmoKV(appContext, "test_churn")
+        for (i in 0 until 20000) {
+            emoKV.put("session_$i", "$i$VALUE_SUFFIX")
+            if (i >= 16) {
+                emoKV.delete("session_${i - 16}")
+            }
+        }
+        for (i in 0 until 20000) {
+            assertEquals(if (i >= 20000 - 16) "$i$VALUE_SUFFIX" else null, emoKV.getString("session_$i"))
+        }
+        emoKV.close()
+    }
+
+    @Test
+    fun kv_compact_long_keys() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_compact_keys").deleteRecursively()
+        val emoKV = EmoKV(appContext, "test_compact_keys")
+        for (i in 0 until 20000) {
+            emoKV.put("$KEY_PREFIX$i", "$i$VALUE_SUFFIX")
+            if (i % 100 != 0) {
+                emoKV.delete("$KEY_PREFIX$i")
+            }
+        }
+        emoKV.compact()
+        for (i in 0 until 20000) {
+            assertEquals(if (i % 100 == 0) "$i$VALUE_SUFFIX" else null, emoKV.getString("$KEY_PREFIX$i"))
+        }
+        emoKV.close()
+    }
+
+    @Test
+    fun kv_compact_while_writing() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_compact_writing").deleteRecursively()
+        val emoKV = EmoKV(
+            appContext,
+            "test_compact_writing",
+            compress = false,
+            compactMinGarbage = Long.MAX_VALUE
+        )
+        // tens of megabytes of live values, so that the files are copied for long enough to write meanwhile.
+        val value = "v".repeat(32 * 1024)
+        for (i in 0 until 2000) {
+            emoKV.put("$KEY_PREFIX$i", "$i$value")
+        }
+        // the dead bytes the compaction gets back.
+        for (i in 1500 until 2000) {
+            emoKV.delete("$KEY_PREFIX$i")
+        }
+        val before = emoKV.maintainSeq(MAINTAIN_COMPACT)
+        emoKV.compact()
+        var deadline = System.currentTimeMillis() + 10_000
+        while (emoKV.maintainSeq(MAINTAIN_COMPACT) == before && System.currentTimeMillis() < deadline) {
+            Thread.sleep(1)
+        }
+        // the writes start while the files are copied.
+        assertEquals(1, emoKV.maintainSeq(MAINTAIN_COMPACT) % 2)
+        for (i in 0 until 1000) {
+            emoKV.put("$KEY_PREFIX$i", "$i")
+        }
+        deadline = System.currentTimeMillis() + 10_000
+        while (emoKV.maintainSeq(MAINTAIN_COMPACT) % 2 == 1 && System.currentTimeMillis() < deadline) {
+            Thread.sleep(1)
+        }
+        assertEquals(before + 2, emoKV.maintainSeq(MAINTAIN_COMPACT))
+        for (i in 0 until 2000) {
+            val expected = when {
+                i < 1000 -> "$i"
+                i < 1500 -> "$i$value"
+                else -> null
+            }
+            assertEquals(expected, emoKV.getString("$KEY_PREFIX$i"))
+        }
+        emoKV.close()
+    }
+
+    @Test
+    fun kv_concurrent_put_get() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_concurrent").deleteRecursively()
+        val emoKV = EmoKV(appContext, "test_concurrent")
+        val keys = 2000
+        val rounds = 20
+        for (i in 0 until keys) {
+            emoKV.put("$KEY_PREFIX$i", "$i:0$VALUE_SUFFIX")
+        }
+        val errors = AtomicInteger()
+        val done = AtomicBoolean()
+        // each writer has its own keys, so they mostly lock different stripes and fill the storages
+        // side by side. the readers check that no value is torn or lost meanwhile.
+        val writers = (0 until 4).map { w ->
+            Thread {
+                for (round in 1 until rounds) {
+                    for (i in w until keys step 4) {
+                        if (!emoKV.put("$KEY_PREFIX$i", "$i:$round$VALUE_SUFFIX")) {
+                            errors.incrementAndGet()
+                        }
+                    }
+                }
+            }
+        }
+        val readers = (0 until 4).map {
+            Thread {
+                while (!done.get()) {
+                    for (i in 0 until keys) {
+                        val value = emoKV.getString("$KEY_PREFIX$i")
+                        if (value == null || !value.startsWith("$i:") || !value.endsWith(VALUE_SUFFIX)) {
+                            errors.incrementAndGet()
+                        }
+                    }
+                }
+            }
+        }
+        (writers + readers).forEach { it.start() }
+        writers.forEach { it.join() }
+        done.set(true)
+        readers.forEach { it.join() }
+        assertEquals(0, errors.get())
+        for (i in 0 until keys) {
+            assertEquals("$i:${rounds - 1}$VALUE_SUFFIX", emoKV.getString("$KEY_PREFIX$i"))
+        }
+        emoKV.close()
+    }
+
+    @Test
+    fun kv_compact_on_garbage_ratio() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_garbage_ratio").deleteRecursively()
+        val emoKV = EmoKV(
+            appContext,
+            "test_garbage_ratio",
+            compress = false,
+            compactGarbageRatio = 0.5f,
+            compactMinGarbage = 256 * 1024
+        )
+        val value = "v".repeat(300)
+        for (i in 0 until 4000) {
+            emoKV.put("key_$i", "$i$value")
+        }
+        val compactions = emoKV.maintainSeq(MAINTAIN_COMPACT)
+        // a quarter of the values is garbage: past compactMinGarbage, but not past the ratio.
+        for (i in 0 until 1000) {
+            emoKV.delete("key_$i")
+        }
+        // a compaction is scheduled by the delete that crosses the ratio, none of these did.
+        val idle = emoKV.maintainSeq(MAINTAIN_COMPACT)
+        assertEquals(compactions, idle)
+        assertEquals(0, idle % 2)
+        // three quarters: a compaction is scheduled.
+        for (i in 1000 until 3000) {
+            emoKV.delete("key_$i")
+        }
+        val deadline = System.currentTimeMillis() + 10_000
+        while (System.currentTimeMillis() < deadline) {
+            val seq = emoKV.maintainSeq(MAINTAIN_COMPACT)
+            if (seq >= compactions + 2 && seq % 2 == 0) {
+                break
+            }
+            Thread.sleep(10)
+        }
+        assertEquals(true, emoKV.maintainSeq(MAINTAIN_COMPACT) >= compactions + 2)
+        for (i in 0 until 4000) {
+            assertEquals(if (i >= 3000) "$i$value" else null, emoKV.getString("key_$i"))
+        }
+        emoKV.close()
+    }
+
+    @Test
+    fun kv_overwrite_in_place() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        val dir = File(appContext.filesDir, "emo/kv/test_in_place")
+        dir.deleteRecursively()
+        // no compaction: appended, the 20000 values would take about 2.5m.
+        val emoKV = EmoKV(appContext, "test_in_place", compress = false, compactMinGarbage = Long.MAX_VALUE)
+        val details = "d".repeat(100)
+        for (i in 0 until 20000) {
+            emoKV.put("last_seen_${i % 10}", "timestamp ${1_000_000_000_000L + i} $details")
+        }
+        for (i in 0 until 10) {
+            assertEquals("timestamp ${1_000_000_000_000L + 19990 + i} $details", emoKV.getString("last_seen_$i"))
+        }
+        emoKV.close()
+        // the values took the places of the ones they replaced, the file never grew.
+        val valueSize = dir.listFiles { file -> file.name.startsWith("value_") }!!.sumOf { it.length() }
+        assertEquals(1024L * 1024, valueSize)
+    }
+
+    @Test
+    fun kv_reuse_free_space() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_free_space").deleteRecursively()
+        // no compaction: the space is only got back by writing in it again.
+        val emoKV = EmoKV(appContext, "test_free_space", compress = false, compactMinGarbage = Long.MAX_VALUE)
+        val value = "v".repeat(4000)
+        for (round in 0 until 50) {
+            for (i in 0 until 100) {
+                emoKV.put("blob_${round}_$i", "$round$value")
+            }
+            for (i in 0 until 100) {
+                emoKV.delete("blob_${round}_$i")
+            }
+        }
+        emoKV.put("blob_last", value)
+        assertEquals(value, emoKV.getString("blob_last"))
+        emoKV.close()
+        val dir = File(appContext.filesDir, "emo/kv/test_free_space")
+        val valueSize = dir.listFiles { file -> file.name.startsWith("value_") }!!.sumOf { it.length() }
+        assertEquals(true, valueSize <= 1024 * 1024)
+    }
+
+    @Test
+    fun kv_large_value_stream() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_large_value").deleteRecursively()
+        val emoKV = EmoKV(appContext, "test_large_value")
+        val value = ByteArray(8 * 1024 * 1024) { (it * 31 + (it shr 12)).toByte() }
+        emoKV.openOutputStream("large", value.size.toLong()).use { os ->
+            for (offset in value.indices step 100_000) {
+                os.write(value, offset, minOf(100_000, value.size - offset))
+            }
+        }
+        // the value the reader opened at is kept while the key is written.
+        val input = emoKV.openInputStream("large")!!
+        emoKV.put("large".toByteArray(), ByteArray(100_000) { 1 })
+        assertArrayEquals(value, input.use { it.readBytes() })
+        assertArrayEquals(ByteArray(100_000) { 1 }, emoKV.openInputStream("large")!!.use { it.readBytes() })
+        assertEquals(null, emoKV.openInputStream("absent"))
+        // a stream closed before all of it is written leaves the key as it was.
+        val partial = emoKV.openOutputStream("large", 10)
+        partial.write(ByteArray(5))
+        assertThrows(IOException::class.java) { partial.close() }
+        assertArrayEquals(ByteArray(100_000) { 1 }, emoKV.get("large".toByteArray()))
+        emoKV.close()
+    }
+
+    @Test
+    fun kv_value_too_long_for_an_array() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        val dir = File(appContext.filesDir, "emo/kv/test_huge_value")
+        dir.deleteRecursively()
+        assumeTrue(appContext.filesDir.usableSpace > 3L * 1024 * 1024 * 1024)
+        val emoKV = EmoKV(appContext, "test_huge_value", crc = false, compress = false, compactMinGarbage = Long.MAX_VALUE)
+        val length = Int.MAX_VALUE + 1L
+        val chunk = ByteArray(1024 * 1024) { it.toByte() }
+        emoKV.openOutputStream("huge", length).use { os ->
+            for (offset in 0 until length step chunk.size.toLong()) {
+                os.write(chunk)
+            }
+        }
+        emoKV.put("small", "small")
+        assertThrows(IllegalStateException::class.java) { emoKV.get("huge".toByteArray()) }
+        assertThrows(IllegalStateException::class.java) { emoKV.get(arrayOf("huge".toByteArray())) }
+        assertThrows(IllegalStateException::class.java) { emoKV.get("huge".toByteArray(), ByteBuffer.allocateDirect(16)) }
+        // the walks with values skip it.
+        assertEquals(listOf("small"), emoKV.scanPrefix("").map { String(it.key) })
+        assertEquals(listOf("huge", "small"), emoKV.scanPrefix("", keysOnly = true).map { String(it.key) })
+        assertEquals(listOf("small"), emoKV.cursor().use { cursor -> cursor.asSequence().map { String(it.key) }.toList() })
+        assertEquals(2, emoKV.keys().size)
+        emoKV.openInputStream("huge")!!.use { input ->
+            assertEquals(0, input.read())
+            assertEquals(1, input.read())
+        }
+        emoKV.close()
+        dir.deleteRecursively()
+    }
+
+    @Test
+    fun kv_grow_past_reserved_mapping() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        val dir = File(appContext.filesDir, "emo/kv/test_grow_mapping")
+        dir.deleteRecursively()
+        assumeTrue(appContext.filesDir.usableSpace > 1024L * 1024 * 1024)
+        val emoKV = EmoKV(appContext, "test_grow_mapping", crc = false, compress = false, compactMinGarbage = Long.MAX_VALUE)
+        for (i in 0 until 1000) {
+            emoKV.put("$KEY_PREFIX$i", "$i$VALUE_SUFFIX")
+        }
+        val errors = AtomicInteger()
+        val done = AtomicBoolean()
+        val readers = (0 until 4).map {
+            Thread {
+                while (!done.get()) {
+                    for (i in 0 until 1000) {
+                        if (emoKV.getString("$KEY_PREFIX$i") != "$i$VALUE_SUFFIX") {
+                            errors.incrementAndGet()
+                        }
+                    }
+                }
+            }
+        }
+        readers.forEach { it.start() }
+        val expansions = emoKV.maintainSeq(MAINTAIN_EXPAND_VALUE)
+        // the value mapping of a 1m store grows in place up to 256m, past it the mapping moves while the
+        // readers are in it.
+        val chunk = ByteArray(1024 * 1024) { it.toByte() }
+        for (n in 0 until 5) {
+            emoKV.openOutputStream("blob_$n", 64L * chunk.size).use { os ->
+                repeat(64) { os.write(chunk) }
+            }
+        }
+        done.set(true)
+        readers.forEach { it.join() }
+        assertEquals(0, errors.get())
+        assertEquals(true, emoKV.maintainSeq(MAINTAIN_EXPAND_VALUE) > expansions)
+        assertEquals(true, dir.listFiles { file -> file.name.startsWith("value_") }!!.sumOf { it.length() } > 256L * 1024 * 1024)
+        emoKV.openInputStream("blob_4")!!.use { input ->
+            assertEquals(0, input.read())
+            assertEquals(1, input.read())
+        }
+        emoKV.close()
+        dir.deleteRecursively()
+    }
+
+    @Test
+    fun kv_sharded_write_read() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_sharded").deleteRecursively()
+        val emoKV = EmoKV(appContext, "test_sharded", shardCount = 4)
+        for (i in 0 until 10000) {
+            emoKV.put("$KEY_PREFIX$i", "$i$VALUE_SUFFIX")
+        }
+        emoKV.close()
+        // the shard count of an existing store is kept.
+        val reopened = EmoKV(appContext, "test_sharded")
+        for (i in 0 until 10000) {
+            assertEquals("$i$VALUE_SUFFIX", reopened.getString("$KEY_PREFIX$i"))
+        }
+        reopened.close()
+    }
+
+    @Test
+    fun kv_write_batch() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_batch").deleteRecursively()
+        val emoKV = EmoKV(appContext, "test_batch")
+        emoKV.put("deleted", 1)
+        val written = emoKV.write {
+            for (i in 0 until 10000) {
+                put("$KEY_PREFIX$i", "$i$VALUE_SUFFIX")
+            }
+            put("int", 42)
+            delete("deleted")
+        }
+        assertEquals(true, written)
+        for (i in 0 until 10000) {
+            assertEquals("$i$VALUE_SUFFIX", emoKV.getString("$KEY_PREFIX$i"))
+        }
+        assertEquals(42, emoKV.getInt("int"))
+        assertEquals(null, emoKV.getString("deleted"))
+        emoKV.close()
+    }
+
+    @Test
+    fun kv_multi_get() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_multi_get").deleteRecursively()
+        val emoKV = EmoKV(appContext, "test_multi_get", shardCount = 2)
+        for (i in 0 until 1000) {
+            emoKV.put("$KEY_PREFIX$i", "$i$VALUE_SUFFIX")
+        }
+        val keys = (0 until 1000).map { "$KEY_PREFIX$it" } + "absent"
+        val values = emoKV.getStrings(keys)
+        for (i in 0 until 1000) {
+            assertEquals("$i$VALUE_SUFFIX", values[i])
+        }
+        assertEquals(null, values[1000])
+        emoKV.close()
+    }
+
+    @Test
+    fun kv_cursor() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_cursor").deleteRecursively()
+        val emoKV = EmoKV(appContext, "test_cursor", shardCount = 2)
+        for (i in 0 until 1000) {
+            emoKV.put("$KEY_PREFIX$i", "$i$VALUE_SUFFIX")
+        }
+        val seen = HashMap<String, String>()
+        emoKV.cursor(chunkSize = 64).use { cursor ->
+            for (entry in cursor) {
+                val key = String(entry.key)
+                assertEquals(null, seen.put(key, String(entry.value!!)))
+                // writes go on meanwhile.
+                emoKV.put("${key}_new", "new")
+            }
+        }
+        for (i in 0 until 1000) {
+            assertEquals("$i$VALUE_SUFFIX", seen["$KEY_PREFIX$i"])
+        }
+        val keys = emoKV.keys().map { String(it) }
+        assertEquals(keys.size, keys.toSet().size)
+        for (i in 0 until 1000) {
+            assertEquals(true, keys.contains("$KEY_PREFIX${i}_new"))
+        }
+        emoKV.close()
+    }
+
+    @Test
+    fun kv_write_under_cursor_reopen() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_cursor_reopen").deleteRecursively()
+        val emoKV = EmoKV(appContext, "test_cursor_reopen")
+        for (i in 0 until 300) {
+            emoKV.put("$KEY_PREFIX$i", "$i")
+        }
+        emoKV.cursor().use {
+            // the index grows, the keys written before are written in the old one meanwhile.
+            for (i in 300 until 900) {
+                emoKV.put("$KEY_PREFIX$i", "$i")
+            }
+            for (i in 0 until 300) {
+                emoKV.put("$KEY_PREFIX$i", "$i$VALUE_SUFFIX")
+            }
+        }
+        emoKV.close()
+        // the values written after the reopen go past the ones written under the cursor.
+        val reopened = EmoKV(appContext, "test_cursor_reopen")
+        for (i in 900 until 2000) {
+            reopened.put("$KEY_PREFIX$i", "$i$VALUE_SUFFIX")
+        }
+        for (i in 0 until 2000) {
+            assertEquals(if (i in 300 until 900) "$i" else "$i$VALUE_SUFFIX", reopened.getString("$KEY_PREFIX$i"))
+        }
+        reopened.close()
+    }
+
+    @Test
+    fun kv_write_during_migration_reopen() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        File(appContext.filesDir, "emo/kv/test_migration").deleteRecursively()
+        val emoKV = EmoKV(appContext, "test_migration")
+        // the cursor holds the migration of the last growth back, it starts once the cursor is closed.
+        emoKV.cursor().use {
+            for (i in 0 until 20000) {
+                emoKV.put("$KEY_PREFIX$i", "$i")
+            }
+        }
+        // each write moves a few items too, the rest is moved in passes between them.
+        for (i in 0 until 20000 step 2) {
+            emoKV.put("$KEY_PREFIX$i", "$i$VALUE_SUFFIX")
+        }
+        for (i in 1 until 20000 step 4) {
+            emoKV.delete("$KEY_PREFIX$i")
+        }
+        for (i in 20000 until 30000) {
+            emoKV.put("$KEY_PREFIX$i", "$i")
+        }
+        emoKV.close()
+        // the migration may still be going on, the reopened store finishes it.
+        val reopened = EmoKV(appContext, "test_migration")
+        for (i in 0 until 30000) {
+            val expected = when {
+                i >= 20000 -> "$i"
+                i % 2 == 0 -> "$i$VALUE_SUFFIX"
+                i % 4 == 1 -> null
+                else -> "$i"
+            }
+            assertEquals(expected, reopened.getString("$KEY_PREFIX$i"))
+        }
+        assertEquals(25000, reopened.keys().size)
+        reopened.close()
+    }
+
+    @Test
+    fun kv_prefix_scan_delete() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        val emoKV = EmoKV(appContext, "test_prefix")
+        emoKV.deletePrefix("")
+        for (i in 0 until 100) {
+            emoKV.put("user.$i.name", "name$i")
+            emoKV.put("feature.$i", i)
+        }
+        val users = emoKV.scanPrefix("user.1")
+        assertEquals(listOf("user.1.name") + (10 until 20).map { "user.$it.name" }, users.map { String(it.key) })
+        assertEquals("name1", String(users[0].value!!))
+        assertEquals(100L, emoKV.deletePrefix("user."))
+        assertEquals(0, emoKV.scanPrefix("user.", keysOnly = true).size)
+        assertEquals(100, emoKV.scanPrefix("feature.", keysOnly = true).size)
+        emoKV.close()
+    }
+
+    @Test
+    fun simple_kv_read_into_buffer() {
+        val appContext = InstrumentationRegistry.getInstrumentation().targetContext
+        val emoKV = EmoKV(appContext, "test_buffer", crc = false, compress = false)
+        val inline = "tiny".toByteArray()
+        val ref = (KEY_PREFIX + VALUE_SUFFIX).toByteArray()
+        emoKV.put("inline".toByteArray(), inline)
+        emoKV.put("ref".toByteArray(), ref)
+        val buffer = ByteBuffer.allocateDirect(1024)
+        assertEquals(inline.size, emoKV.get("inline".toByteArray(), buffer))
+        assertEquals(ref.size, emoKV.get("ref".toByteArray(), buffer))
+        assertEquals(inline.size + ref.size, buffer.position())
+        buffer.flip()
+        val read = ByteArray(buffer.remaining())
+        buffer.get(read)
+        assertArrayEquals(inline + ref, read)
+        assertEquals(-1, emoKV.get("absent".toByteArray(), buffer))
+        val small = ByteBuffer.allocateDirect(8)
+        assertEquals(ref.size, emoKV.get("ref".toByteArray(), small))
+        assertEquals(0, small.position())
+        emoKV.close()
+    }
+
     @Test
     fun w_kv_write_read() {
         // Context of the app under test.
@@ -18,28 +18,69 @@ package cn.qhplus.emo.kv
 
 import android.content.Context
 import java.io.ByteArrayOutputStream
+import java.io.Closeable
 import java.io.File
+import java.io.IOException
+import java.io.InputStream
+import java.io.OutputStream
 import java.nio.ByteBuffer
+import java.nio.ByteOrder
 import java.util.zip.CRC32
 import java.util.zip.Deflater
 import java.util.zip.Inflater
+import java.util.zip.InflaterInputStream
 import kotlin.experimental.and
 import kotlin.experimental.or
 
 private const val FLAG_COMPRESSED: Byte = 0x1
 private const val FLAG_CRC: Byte = 0x2
 
+// the ops of a WriteBatch, see WriteBatch.h.
+private const val OP_PUT = 1
+private const val OP_DEL = 2
+
+// the maintenance passes counted by maintainSeq, see KV.h.
+internal const val MAINTAIN_EXPAND_INDEX = 0
+internal const val MAINTAIN_EXPAND_KEY = 1
+internal const val MAINTAIN_EXPAND_VALUE = 2
+internal const val MAINTAIN_COMPACT = 3
+
+private fun Boolean.toBytes() = ByteBuffer.allocate(Int.SIZE_BYTES).putInt(if (this) 1 else 0).array()
+private fun Char.toBytes() = ByteBuffer.allocate(Short.SIZE_BYTES).putChar(this).array()
+private fun Short.toBytes() = ByteBuffer.allocate(Short.SIZE_BYTES).putShort(this).array()
+private fun Int.toBytes() = ByteBuffer.allocate(Int.SIZE_BYTES).putInt(this).array()
+private fun Long.toBytes() = ByteBuffer.allocate(Long.SIZE_BYTES).putLong(this).array()
+private fun Float.toBytes() = ByteBuffer.allocate(Float.SIZE_BYTES).putFloat(this).array()
+private fun Double.toBytes() = ByteBuffer.allocate(Double.SIZE_BYTES).putDouble(this).array()
+
+// hands its buffer to the native side without a copy.
+internal class BatchStream : ByteArrayOutputStream(256) {
+    fun buffer(): ByteArray = buf
+
+    fun writeLe(value: Int, bytes: Int) {
+        for (i in 0 until bytes) {
+            write(value ushr (i * 8))
+        }
+    }
+}
+
 class EmoKV(
     context: Context,
     name: String,
     private val crc: Boolean = true,
     private val compress: Boolean = true,
     private val compressMiniLen: Int = 500,
-    indexInitSpace: Long = 16384, // 16k, for about 600 item when hash factor = 0.75.
+    indexInitSpace: Long = 17024, // 128 bytes header + 512 slots of 33 bytes, for about 380 item when hash factor = 0.75.
     keyInitSpace: Long = 4096, // 4k
     valueInitSpace: Long = 1024 * 1024, // 1m
     hashFactor: Float = 0.75f,
-    valueUpdateCountToAutoCompact: Int = 5000,
+    // the files are compacted once this part of them is overwritten or deleted data, and at least
+    // compactMinGarbage bytes.
+    compactGarbageRatio: Float = 0.5f,
+    compactMinGarbage: Long = 1024 * 1024, // 1m
+    // a new store is split in this many shards with their own files, so that growing or compacting one
+    // only costs a part of the data. the count of an existing store can't be changed.
+    shardCount: Int = 1,
     private val validateFailedReporter: ((key: ByteArray, e: Throwable) -> Boolean)? = null
 ) {
     companion object {
@@ -57,6 +98,9 @@ class EmoKV(
     }
 
     private var nativePtr: Long
+    // closed along with the store, guarded by the store.
+    private val cursors = HashSet<Cursor>()
+    private val streams = HashSet<Closeable>()
 
     init {
         checkLoadLibrary()
@@ -72,7 +116,9 @@ class EmoKV(
             keyInitSpace,
             valueInitSpace,
             hashFactor,
-            valueUpdateCountToAutoCompact
+            compactGarbageRatio,
+            compactMinGarbage,
+            shardCount
         )
         if (nativePtr == 0L) {
             throw RuntimeException("native init failed.")
@@ -82,6 +128,8 @@ class EmoKV(
     // will release the resources. recommend call this in worker thread.
     @Synchronized
     fun close() {
+        cursors.toList().forEach { it.close() }
+        streams.toList().forEach { it.close() }
         if (nativePtr != 0L) {
             nClose(nativePtr)
             nativePtr = 0L
@@ -138,9 +186,54 @@ class EmoKV(
         return get(key.toByteArray())?.let { String(it) }
     }
 
+    // a value of more than Int.MAX_VALUE bytes can't be held in an array, it's only read with
+    // openInputStream and the gets throw IllegalStateException for it.
     fun get(key: ByteArray): ByteArray? {
         validNotClosed()
         val ret = nGet(nativePtr, key) ?: return null
+        return decode(key, ret)
+    }
+
+    // Reads all the values with one native call, null for the keys that are absent.
+    // cheaper than a get per key when many known keys are read together, e.g. at startup.
+    fun get(keys: Array<ByteArray>): Array<ByteArray?> {
+        validNotClosed()
+        val ret = nMultiGet(nativePtr, keys)
+        for (i in ret.indices) {
+            ret[i] = ret[i]?.let { decode(keys[i], it) }
+        }
+        return ret
+    }
+
+    fun getStrings(keys: List<String>): List<String?> {
+        return get(Array(keys.size) { keys[it].toByteArray() }).map { it?.let { value -> String(value) } }
+    }
+
+    // Reads the value of key into dst from its position and advances the position.
+    // Without crc and compress the value is copied straight from the storage into dst,
+    // so dst must be a direct buffer. returns the value length, or -1 if the key is absent.
+    // it throws IllegalStateException for a value too long for an array, as get does.
+    // if the value doesn't fit in dst.remaining(), dst is untouched and the length is returned.
+    fun get(key: ByteArray, dst: ByteBuffer): Int {
+        validNotClosed()
+        if (compress || crc) {
+            val data = get(key) ?: return -1
+            if (data.size <= dst.remaining()) {
+                dst.put(data)
+            }
+            return data.size
+        }
+        if (!dst.isDirect) {
+            throw IllegalArgumentException("dst must be a direct buffer")
+        }
+        val len = nGetInto(nativePtr, key, dst, dst.position(), dst.remaining())
+        if (len in 0..dst.remaining()) {
+            dst.position(dst.position() + len)
+        }
+        return len
+    }
+
+    private fun decode(key: ByteArray, ret: ByteArray): ByteArray? {
         if (!compress && !crc) {
             return ret
         }
@@ -182,52 +275,31 @@ class EmoKV(
     }
 
     fun put(key: String, value: Boolean): Boolean {
-        return put(
-            key.toByteArray(),
-            ByteBuffer.allocate(Int.SIZE_BYTES).putInt(if (value) 1 else 0).array()
-        )
+        return put(key.toByteArray(), value.toBytes())
     }
 
     fun put(key: String, value: Char): Boolean {
-        return put(
-            key.toByteArray(),
-            ByteBuffer.allocate(Short.SIZE_BYTES).putChar(value).array()
-        )
+        return put(key.toByteArray(), value.toBytes())
     }
 
     fun put(key: String, value: Short): Boolean {
-        return put(
-            key.toByteArray(),
-            ByteBuffer.allocate(Short.SIZE_BYTES).putShort(value).array()
-        )
+        return put(key.toByteArray(), value.toBytes())
     }
 
     fun put(key: String, value: Int): Boolean {
-        return put(
-            key.toByteArray(),
-            ByteBuffer.allocate(Int.SIZE_BYTES).putInt(value).array()
-        )
+        return put(key.toByteArray(), value.toBytes())
     }
 
     fun put(key: String, value: Long): Boolean {
-        return put(
-            key.toByteArray(),
-            ByteBuffer.allocate(Long.SIZE_BYTES).putLong(value).array()
-        )
+        return put(key.toByteArray(), value.toBytes())
     }
 
     fun put(key: String, value: Float): Boolean {
-        return put(
-            key.toByteArray(),
-            ByteBuffer.allocate(Float.SIZE_BYTES).putFloat(value).array()
-        )
+        return put(key.toByteArray(), value.toBytes())
     }
 
     fun put(key: String, value: Double): Boolean {
-        return put(
-            key.toByteArray(),
-            ByteBuffer.allocate(Double.SIZE_BYTES).putDouble(value).array()
-        )
+        return put(key.toByteArray(), value.toBytes())
     }
 
     fun put(key: String, value: String): Boolean {
@@ -236,15 +308,19 @@ class EmoKV(
 
     fun put(key: ByteArray, value: ByteArray): Boolean {
         validNotClosed()
-        if (key.size > 256) {
-            throw RuntimeException("key's len can not be more than 256")
-        }
-        if (value.size > 65536) {
-            throw RuntimeException("value's len can not be more than 65536")
+        return nPut(nativePtr, key, encode(key, value))
+    }
+
+    private fun validKey(key: ByteArray) {
+        if (key.size > 255) {
+            throw RuntimeException("key's len can not be more than 255")
         }
+    }
 
+    private fun encode(key: ByteArray, value: ByteArray): ByteArray {
+        validKey(key)
         if (!compress && !crc) {
-            return nPut(nativePtr, key, value)
+            return value
         }
         val buffer = ByteArray(value.size.coerceAtMost(512))
         val os = ByteArrayOutputStream(value.size.coerceAtMost(512))
@@ -282,8 +358,7 @@ class EmoKV(
             os.write(value, 0, value.size)
             os.write(byteArrayOf(0))
         }
-        val ret = os.toByteArray()
-        return nPut(nativePtr, key, ret)
+        return os.toByteArray()
     }
 
     fun delete(key: String) {
@@ -295,11 +370,423 @@ class EmoKV(
         nDelete(nativePtr, key)
     }
 
+    fun batch(): WriteBatch = WriteBatch()
+
+    // Applies the ops of the batch in order with one native call: after a crash the store has either
+    // all of them or none. A sharded store only keeps that per shard.
+    fun write(batch: WriteBatch): Boolean {
+        validNotClosed()
+        if (batch.owner !== this) {
+            throw IllegalArgumentException("the batch is made by another EmoKV")
+        }
+        return nWrite(nativePtr, batch.os.buffer(), batch.os.size())
+    }
+
+    fun write(block: WriteBatch.() -> Unit): Boolean {
+        return write(WriteBatch().apply(block))
+    }
+
+    // Collects puts and deletes for [write], the values are encoded as they are added. not thread safe.
+    inner class WriteBatch internal constructor() {
+        internal val owner = this@EmoKV
+        internal val os = BatchStream()
+
+        fun put(key: String, value: Boolean) = put(key.toByteArray(), value.toBytes())
+        fun put(key: String, value: Char) = put(key.toByteArray(), value.toBytes())
+        fun put(key: String, value: Short) = put(key.toByteArray(), value.toBytes())
+        fun put(key: String, value: Int) = put(key.toByteArray(), value.toBytes())
+        fun put(key: String, value: Long) = put(key.toByteArray(), value.toBytes())
+        fun put(key: String, value: Float) = put(key.toByteArray(), value.toBytes())
+        fun put(key: String, value: Double) = put(key.toByteArray(), value.toBytes())
+        fun put(key: String, value: String) = put(key.toByteArray(), value.toByteArray())
+
+        fun put(key: ByteArray, value: ByteArray): WriteBatch {
+            val data = encode(key, value)
+            os.write(OP_PUT)
+            os.writeLe(key.size, Short.SIZE_BYTES)
+            os.write(key)
+            os.writeLe(data.size, Int.SIZE_BYTES)
+            os.write(data)
+            return this
+        }
+
+        fun delete(key: String) = delete(key.toByteArray())
+
+        fun delete(key: ByteArray): WriteBatch {
+            validKey(key)
+            os.write(OP_DEL)
+            os.writeLe(key.size, Short.SIZE_BYTES)
+            os.write(key)
+            return this
+        }
+
+        fun clear() {
+            os.reset()
+        }
+    }
+
+    // Walks all the entries, close it when done: the store holds its maintenance back meanwhile.
+    fun cursor(keysOnly: Boolean = false, chunkSize: Int = 256): Cursor {
+        validNotClosed()
+        return Cursor(keysOnly, chunkSize)
+    }
+
+    // all the keys, walked again from the start if writes broke the walk.
+    fun keys(): List<ByteArray> {
+        while (true) {
+            try {
+                return cursor(keysOnly = true).use { cursor -> cursor.asSequence().map { it.key }.toList() }
+            } catch (e: ConcurrentModificationException) {
+                // walk again.
+            }
+        }
+    }
+
+    class Entry(val key: ByteArray, val value: ByteArray?)
+
+    // an entry packed by the native side as key_len(2):key[:value_len(4):value], little endian. the entries
+    // with a value too long for an array are left out, see get.
+    // null if the value fails to validate and the reporter lets it go.
+    private fun readEntry(packed: ByteBuffer, keysOnly: Boolean): Entry? {
+        val key = ByteArray(packed.short.toInt() and 0xFFFF)
+        packed.get(key)
+        if (keysOnly) {
+            return Entry(key, null)
+        }
+        val value = ByteArray(packed.int)
+        packed.get(value)
+        return decode(key, value)?.let { Entry(key, it) }
+    }
+
+    // The entries whose keys start with prefix, in key order. The first scan of a store sorts its keys
+    // once, they are kept sorted along with the writes from then on. Unless keysOnly, the entries with a
+    // value too long for an array are skipped, see get.
+    fun scanPrefix(prefix: ByteArray, keysOnly: Boolean = false): List<Entry> {
+        validNotClosed()
+        val packed = ByteBuffer.wrap(nScanPrefix(nativePtr, prefix, keysOnly)).order(ByteOrder.LITTLE_ENDIAN)
+        val ret = ArrayList<Entry>()
+        while (packed.hasRemaining()) {
+            readEntry(packed, keysOnly)?.let { ret.add(it) }
+        }
+        return ret
+    }
+
+    fun scanPrefix(prefix: String, keysOnly: Boolean = false): List<Entry> {
+        return scanPrefix(prefix.toByteArray(), keysOnly)
+    }
+
+    // Deletes the keys that start with prefix as one batch, see [write]. returns the count of them, -1 if it fails.
+    fun deletePrefix(prefix: ByteArray): Long {
+        validNotClosed()
+        return nDeletePrefix(nativePtr, prefix)
+    }
+
+    fun deletePrefix(prefix: String): Long {
+        return deletePrefix(prefix.toByteArray())
+    }
+
+    // Iterates the entries, [chunkSize] of them are read with each native call. Entries written while
+    // it's open may be seen or not, but none is seen twice. A write that has to move the entries under it
+    // anyway breaks the walk with ConcurrentModificationException. values are null when keysOnly, else the
+    // entries with a value too long for an array are skipped, see get. not thread safe.
+    inner class Cursor internal constructor(private val keysOnly: Boolean, private val chunkSize: Int) :
+        Iterator<Entry>, Closeable {
+        private var ptr = nCursorOpen(nativePtr, keysOnly)
+        private var chunk: ByteBuffer? = null
+        private var next: Entry? = null
+        private var done = false
+
+        init {
+            synchronized(this@EmoKV) {
+                cursors.add(this)
+            }
+        }
+
+        override fun hasNext(): Boolean {
+            while (next == null && !done) {
+                val current = chunk
+                if (current == null || !current.hasRemaining()) {
+                    if (ptr == 0L) {
+                        throw IllegalStateException("the cursor is closed")
+                    }
+                    val data = nCursorNext(ptr, chunkSize) ?: throw ConcurrentModificationException("the entries are moved by writes")
+                    done = data.isEmpty()
+                    chunk = ByteBuffer.wrap(data).order(ByteOrder.LITTLE_ENDIAN)
+                    continue
+                }
+                next = readEntry(current, keysOnly)
+            }
+            return next != null
+        }
+
+        override fun next(): Entry {
+            if (!hasNext()) {
+                throw NoSuchElementException()
+            }
+            return next!!.also { next = null }
+        }
+
+        override fun close() {
+            synchronized(this@EmoKV) {
+                if (ptr != 0L) {
+                    nCursorClose(ptr)
+                    ptr = 0L
+                    cursors.remove(this)
+                }
+            }
+        }
+    }
+
+    // Reads the value of key a chunk at a time, copied straight from the storage into the arrays given to
+    // read, so that a long value is never read as a whole. It reads the value the key had when it opened
+    // even if the key is written meanwhile. A crc mismatch is only known at the end, where it's thrown as
+    // an IOException unless validateFailedReporter lets it go. close it when done: the store holds its
+    // compaction back meanwhile. null if the key is absent.
+    fun openInputStream(key: ByteArray): InputStream? {
+        validNotClosed()
+        val ptr = nValueReaderOpen(nativePtr, key)
+        if (ptr == 0L) {
+            return null
+        }
+        val raw = ValueInputStream(ptr, nValueReaderLength(ptr))
+        if ((!compress && !crc) || raw.length == 0L) {
+            return raw
+        }
+        try {
+            // the trailer of encode: [crc(8):]flag(1).
+            val flag = raw.readAt(raw.length - 1, 1)[0]
+            val isCrc = (flag and FLAG_CRC) == FLAG_CRC
+            val isCompressed = (flag and FLAG_COMPRESSED) == FLAG_COMPRESSED
+            raw.limit = raw.length - 1 - if (isCrc) Long.SIZE_BYTES else 0
+            val data = if (isCompressed) InflaterInputStream(raw) else raw
+            if (!isCrc) {
+                return data
+            }
+            return CrcInputStream(key, data, ByteBuffer.wrap(raw.readAt(raw.limit, Long.SIZE_BYTES)).long)
+        } catch (e: Throwable) {
+            raw.close()
+            throw e
+        }
+    }
+
+    fun openInputStream(key: String): InputStream? {
+        return openInputStream(key.toByteArray())
+    }
+
+    // Writes a value of length bytes for key a chunk at a time, copied straight from the arrays given to
+    // write into the space placed for it in the storage. The key gets the value on close once all of it
+    // is written, and keeps the one it had if the stream is closed before, which throws, or aborted.
+    // The value is not compressed. the store holds its compaction back until it's closed.
+    fun openOutputStream(key: ByteArray, length: Long): ValueOutputStream {
+        validNotClosed()
+        validKey(key)
+        if (length < 0) {
+            throw IllegalArgumentException("length can not be negative")
+        }
+        // room for the trailer of encode.
+        val trailer = if (crc) Long.SIZE_BYTES + 1 else if (compress) 1 else 0
+        val ptr = nValueWriterOpen(nativePtr, key, length + trailer)
+        if (ptr == 0L) {
+            throw IOException("no space for a value of $length bytes")
+        }
+        return ValueOutputStream(ptr, length)
+    }
+
+    fun openOutputStream(key: String, length: Long): ValueOutputStream {
+        return openOutputStream(key.toByteArray(), length)
+    }
+
+    private inner class ValueInputStream(private var ptr: Long, val length: Long) : InputStream() {
+        // the end of what read gives, the trailer is past it.
+        var limit = length
+        private var pos = 0L
+        private var mark = 0L
+
+        init {
+            synchronized(this@EmoKV) {
+                streams.add(this)
+            }
+        }
+
+        fun readAt(offset: Long, len: Int): ByteArray {
+            val data = ByteArray(len)
+            if (offset < 0 || nValueReaderRead(validPtr(), offset, data, 0, len) != len) {
+                throw IOException("the value is shorter than its trailer")
+            }
+            return data
+        }
+
+        override fun read(): Int {
+            val one = ByteArray(1)
+            return if (read(one, 0, 1) == 1) one[0].toInt() and 0xFF else -1
+        }
+
+        override fun read(b: ByteArray, off: Int, len: Int): Int {
+            if (off < 0 || len < 0 || len > b.size - off) {
+                throw IndexOutOfBoundsException()
+            }
+            if (len == 0) {
+                return 0
+            }
+            if (pos >= limit) {
+                return -1
+            }
+            val n = nValueReaderRead(validPtr(), pos, b, off, minOf(len.toLong(), limit - pos).toInt())
+            pos += n
+            return n
+        }
+
+        override fun skip(n: Long): Long {
+            val skipped = n.coerceIn(0, limit - pos)
+            pos += skipped
+            return skipped
+        }
+
+        override fun available(): Int = (limit - pos).coerceAtMost(Int.MAX_VALUE.toLong()).toInt()
+
+        override fun markSupported(): Boolean = true
+
+        override fun mark(readlimit: Int) {
+            mark = pos
+        }
+
+        override fun reset() {
+            pos = mark
+        }
+
+        override fun close() {
+            synchronized(this@EmoKV) {
+                if (ptr != 0L) {
+                    nValueReaderClose(ptr)
+                    ptr = 0L
+                    streams.remove(this)
+                }
+            }
+        }
+
+        private fun validPtr(): Long {
+            if (ptr == 0L) {
+                throw IOException("the stream is closed")
+            }
+            return ptr
+        }
+    }
+
+    // checks the crc of what it reads once it's all read.
+    private inner class CrcInputStream(private val key: ByteArray, private val data: InputStream, private val expected: Long) :
+        InputStream() {
+        private val crc32 = CRC32()
+        private var checked = false
+
+        override fun read(): Int {
+            val one = ByteArray(1)
+            return if (read(one, 0, 1) == 1) one[0].toInt() and 0xFF else -1
+        }
+
+        override fun read(b: ByteArray, off: Int, len: Int): Int {
+            val n = data.read(b, off, len)
+            if (n > 0) {
+                crc32.update(b, off, n)
+            } else if (n < 0 && !checked) {
+                checked = true
+                if (crc32.value != expected) {
+                    val e = IOException("validate crc failed for key(${String(key)})")
+                    if (validateFailedReporter?.invoke(key, e) != true) {
+                        throw e
+                    }
+                }
+            }
+            return n
+        }
+
+        override fun available(): Int = data.available()
+
+        override fun close() {
+            data.close()
+        }
+    }
+
+    // See [openOutputStream]. not thread safe.
+    inner class ValueOutputStream internal constructor(private var ptr: Long, val length: Long) : OutputStream() {
+        private val crc32 = if (crc) CRC32() else null
+        private var written = 0L
+        // what the store closes it with, which drops the value.
+        private val releaser = Closeable { abort() }
+
+        init {
+            synchronized(this@EmoKV) {
+                streams.add(releaser)
+            }
+        }
+
+        override fun write(b: Int) {
+            write(byteArrayOf(b.toByte()), 0, 1)
+        }
+
+        override fun write(b: ByteArray, off: Int, len: Int) {
+            if (off < 0 || len < 0 || len > b.size - off) {
+                throw IndexOutOfBoundsException()
+            }
+            if (ptr == 0L) {
+                throw IOException("the stream is closed")
+            }
+            if (len > length - written) {
+                throw IOException("more than $length bytes written")
+            }
+            if (!nValueWriterWrite(ptr, b, off, len)) {
+                throw IOException("the value can't be written")
+            }
+            crc32?.update(b, off, len)
+            written += len
+        }
+
+        // closes it without giving the value to the key.
+        fun abort() {
+            synchronized(this@EmoKV) {
+                if (ptr != 0L) {
+                    nValueWriterClose(ptr)
+                    ptr = 0L
+                    streams.remove(releaser)
+                }
+            }
+        }
+
+        override fun close() {
+            if (ptr == 0L) {
+                return
+            }
+            try {
+                if (written != length) {
+                    throw IOException("closed at $written of $length bytes, the value is dropped")
+                }
+                val trailer = if (crc32 != null) {
+                    ByteBuffer.allocate(Long.SIZE_BYTES + 1).putLong(crc32.value).put(FLAG_CRC).array()
+                } else if (compress) {
+                    byteArrayOf(0)
+                } else {
+                    ByteArray(0)
+                }
+                if (!nValueWriterWrite(ptr, trailer, 0, trailer.size) || !nValueWriterCommit(ptr)) {
+                    throw IOException("the value can't be written")
+                }
+            } finally {
+                abort()
+            }
+        }
+    }
+
     fun compact() {
         validNotClosed()
         nCompact(nativePtr)
     }
 
+    // odd while a maintenance pass of the kind runs, it grows by 2 for each finished one. for tests
+    // that need a write to overlap a pass.
+    internal fun maintainSeq(kind: Int): Int {
+        validNotClosed()
+        return nMaintainSeq(nativePtr, kind)
+    }
+
     private fun validNotClosed() {
         if (nativePtr == 0L) {
             throw RuntimeException("EmoKv is Closed!!!")
@@ -307,6 +794,7 @@ class EmoKV(
     }
 
     private external fun nCompact(nativePtr: Long)
+    private external fun nMaintainSeq(nativePtr: Long, kind: Int): Int
 
     private external fun nInit(
         dir: String,
@@ -314,12 +802,30 @@ class EmoKV(
         keyInitSpace: Long,
         valueInitSpace: Long,
         hashFactor: Float,
-        valueUpdateCountToAutoCompact: Int = 5000
+        compactGarbageRatio: Float = 0.5f,
+        compactMinGarbage: Long = 1024 * 1024,
+        shardCount: Int = 1
     ): Long
 
     private external fun nPut(nativePtr: Long, key: ByteArray, value: ByteArray): Boolean
     private external fun nGet(nativePtr: Long, key: ByteArray): ByteArray?
+    private external fun nMultiGet(nativePtr: Long, keys: Array<ByteArray>): Array<ByteArray?>
+    private external fun nGetInto(nativePtr: Long, key: ByteArray, dst: ByteBuffer, position: Int, remaining: Int): Int
     private external fun nDelete(nativePtr: Long, key: ByteArray)
+    private external fun nWrite(nativePtr: Long, batch: ByteArray, len: Int): Boolean
+    private external fun nScanPrefix(nativePtr: Long, prefix: ByteArray, keysOnly: Boolean): ByteArray
+    private external fun nDeletePrefix(nativePtr: Long, prefix: ByteArray): Long
+    private external fun nCursorOpen(nativePtr: Long, keysOnly: Boolean): Long
+    private external fun nCursorNext(cursorPtr: Long, max: Int): ByteArray?
+    private external fun nCursorClose(cursorPtr: Long)
+    private external fun nValueReaderOpen(nativePtr: Long, key: ByteArray): Long
+    private external fun nValueReaderLength(readerPtr: Long): Long
+    private external fun nValueReaderRead(readerPtr: Long, offset: Long, dst: ByteArray, off: Int, len: Int): Int
+    private external fun nValueReaderClose(readerPtr: Long)
+    private external fun nValueWriterOpen(nativePtr: Long, key: ByteArray, length: Long): Long
+    private external fun nValueWriterWrite(writerPtr: Long, src: ByteArray, off: Int, len: Int): Boolean
+    private external fun nValueWriterCommit(writerPtr: Long): Boolean
+    private external fun nValueWriterClose(writerPtr: Long)
     private external fun nClose(nativePtr: Long)
 
     protected fun finalize() {
@@ -3,8 +3,9 @@
 //
 
 #include <cstdlib>
+#include <cstring>
 #include "Buf.h"
-#include "util/log.h"
+#include "util/hash.h"
 
 namespace EmoKV {
     Buf::Buf(const uint8_t* ptr, size_t len, bool own): ptr_(ptr), len_(len), own_(own){
@@ -15,12 +16,8 @@ namespace EmoKV {
             free((void *)ptr_);
         }
     }
-    uint32_t Buf::hash(uint32_t max){
-        uint32_t hash = 0;
-        for(size_t i = 0; i < len_; i++){
-            hash = hash * 31 + *(ptr_ + i);
-        }
-        return hash % max;
+    uint64_t Buf::hash(uint64_t seed) const{
+        return hash_bytes(ptr_, len_, seed);
     }
 
     bool Buf::equal(Buf* buf){
@@ -30,12 +27,7 @@ namespace EmoKV {
         if(buf->ptr_ == ptr_){
             return true;
         }
-        for(size_t i =0; i < len_; i++){
-            if(*(buf->ptr_ + i) != *(ptr_ + i)){
-                return false;
-            }
-        }
-        return true;
+        return memcmp(buf->ptr_, ptr_, len_) == 0;
     }
 
     const uint8_t* Buf::ptr(){
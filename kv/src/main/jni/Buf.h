@@ -13,7 +13,7 @@ namespace EmoKV {
         Buf(const uint8_t* ptr, size_t len, bool own);
         ~Buf();
         const uint8_t* ptr();
-        uint32_t hash(uint32_t max);
+        uint64_t hash(uint64_t seed) const;
         bool equal(Buf* buf);
         size_t len() const;
     private:
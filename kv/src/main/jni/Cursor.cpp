@@ -0,0 +1,70 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#include "Cursor.h"
+#include "KV.h"
+
+namespace EmoKV {
+    Cursor::Cursor(KV* kv, bool keys_only): kv_(kv), keys_only_(keys_only) {
+    }
+
+    Cursor::~Cursor() {
+        if(shards_.empty()){
+            kv_->close_cursor();
+        }
+    }
+
+    int Cursor::Next(uint32_t max, const EntrySink& sink) {
+        if(!shards_.empty()){
+            return next_shards(max, sink);
+        }
+        EpochGuard guard(kv_->epoch_);
+        if(kv_->forced_moves_.load() != forced_moves_){
+            return CURSOR_BROKEN;
+        }
+        Generation* gen = kv_->generation_.load();
+        uint32_t count = 0;
+        while (count < max && part_ < 2){
+            Index* index = parts_[part_];
+            if(index == nullptr || pos_ >= index->capability()){
+                part_++;
+                pos_ = 0;
+                continue;
+            }
+            count += index->scan(gen->key, gen->value, pos_, max - count, keys_only_, sink);
+            if(count < max && pos_ < index->capability()){
+                // the item points past the storages of gen: they grew after it was loaded.
+                Generation* latest = kv_->generation_.load();
+                if(latest == gen){
+                    // not written by any writer, skip it rather than stop the walk there.
+                    pos_++;
+                }
+                gen = latest;
+            }
+        }
+        while (part_ < 2 && (parts_[part_] == nullptr || pos_ >= parts_[part_]->capability())){
+            part_++;
+            pos_ = 0;
+        }
+        return part_ < 2 ? CURSOR_MORE : CURSOR_DONE;
+    }
+
+    int Cursor::next_shards(uint32_t max, const EntrySink& sink) {
+        uint32_t count = 0;
+        EntrySink counting = [&sink, &count](const uint8_t* key, size_t key_len, const uint8_t* value, size_t value_len) {
+            count++;
+            sink(key, key_len, value, value_len);
+        };
+        while (count < max && shard_ < shards_.size()){
+            int ret = shards_[shard_]->Next(max - count, counting);
+            if(ret == CURSOR_BROKEN){
+                return ret;
+            }
+            if(ret == CURSOR_DONE){
+                shard_++;
+            }
+        }
+        return shard_ < shards_.size() ? CURSOR_MORE : CURSOR_DONE;
+    }
+}
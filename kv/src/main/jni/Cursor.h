@@ -0,0 +1,50 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#ifndef EMO_CURSOR_H
+#define EMO_CURSOR_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "data/Index.h"
+
+#define CURSOR_DONE 0
+#define CURSOR_MORE 1
+#define CURSOR_BROKEN (-1)
+
+namespace EmoKV {
+    class KV;
+
+    // Walks the live items of a KV a chunk at a time, made by KV::NewCursor.
+    // While a cursor is open the KV keeps its items where they are: the migration of a growing index
+    // pauses and compaction waits for the last cursor to close. Items written meanwhile may be seen or
+    // not, but no item is seen twice or missed. A write that can't go on without moving items (the new
+    // index got full) moves them anyway and breaks the cursor, Next says so with CURSOR_BROKEN.
+    class Cursor {
+    public:
+        friend class KV;
+        ~Cursor();
+        // gives up to max entries to sink, the bytes are only valid in the call. the entries with a value
+        // past INDEX_MAX_SCAN_VALUE_LEN are skipped unless it's keys only.
+        // CURSOR_MORE when there may be more, CURSOR_DONE at the end, CURSOR_BROKEN as above.
+        int Next(uint32_t max, const EntrySink& sink);
+
+    private:
+        Cursor(KV* kv, bool keys_only);
+        KV* kv_;
+        bool keys_only_;
+        // old_index then index of the generation the cursor opened at, walked in that order.
+        Index* parts_[2] = {nullptr, nullptr};
+        uint32_t part_ = 0;
+        uint32_t pos_ = 0;
+        uint32_t forced_moves_ = 0;
+        // one for each shard of a sharded KV, walked in turn.
+        std::vector<std::unique_ptr<Cursor>> shards_;
+        size_t shard_ = 0;
+        int next_shards(uint32_t max, const EntrySink& sink);
+    };
+}
+
+#endif //EMO_CURSOR_H
@@ -0,0 +1,86 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#include "Epoch.h"
+
+#include <thread>
+
+namespace EmoKV {
+    // spreads the threads over the slots, a thread keeps using the same one.
+    static uint32_t slot_hint(){
+        static thread_local uint32_t hint = static_cast<uint32_t>(
+                std::hash<std::thread::id>()(std::this_thread::get_id()) * 0x9E3779B1u) >> 7;
+        return hint & (EPOCH_SLOTS - 1);
+    }
+
+    Epoch::Epoch(): epoch_(1){
+        for(auto& slot : slots_){
+            slot.epoch.store(0);
+        }
+    }
+
+    Epoch::~Epoch(){
+        for(auto& item : retired_){
+            item.second();
+        }
+    }
+
+    uint32_t Epoch::pin(){
+        uint32_t slot = slot_hint();
+        // an epoch that is already behind is fine: it only keeps more alive.
+        uint64_t epoch = epoch_.load();
+        while (true){
+            uint64_t free = 0;
+            if(slots_[slot].epoch.compare_exchange_strong(free, epoch)){
+                return slot;
+            }
+            slot = (slot + 1) & (EPOCH_SLOTS - 1);
+        }
+    }
+
+    void Epoch::unpin(uint32_t slot){
+        slots_[slot].epoch.store(0, std::memory_order_release);
+    }
+
+    void Epoch::retire(std::function<void()> free){
+        // the caller unpublished it before: a reader pinned after this can't reach it.
+        uint64_t epoch = epoch_.fetch_add(1);
+        std::lock_guard<std::mutex> lock(retired_lock_);
+        retired_.emplace_back(epoch, std::move(free));
+    }
+
+    bool Epoch::reclaim(){
+        std::vector<std::function<void()>> frees;
+        {
+            std::lock_guard<std::mutex> lock(retired_lock_);
+            if(retired_.empty()){
+                return true;
+            }
+            uint64_t oldest = UINT64_MAX;
+            for(auto& slot : slots_){
+                uint64_t epoch = slot.epoch.load();
+                if(epoch != 0 && epoch < oldest){
+                    oldest = epoch;
+                }
+            }
+            size_t kept = 0;
+            for(size_t i = 0; i < retired_.size(); i++){
+                if(retired_[i].first < oldest){
+                    frees.push_back(std::move(retired_[i].second));
+                }else{
+                    if(kept != i){
+                        retired_[kept] = std::move(retired_[i]);
+                    }
+                    kept++;
+                }
+            }
+            retired_.resize(kept);
+        }
+        for(auto& free : frees){
+            free();
+        }
+        std::lock_guard<std::mutex> lock(retired_lock_);
+        return retired_.empty();
+    }
+}
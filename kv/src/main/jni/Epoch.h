@@ -0,0 +1,63 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#ifndef EMO_EPOCH_H
+#define EMO_EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// a power of two, more concurrent readers than slots just probe for a free one.
+#define EPOCH_SLOTS 128
+
+namespace EmoKV {
+
+    // Epoch based reclamation: a reader pins the current epoch in a slot of its own while it uses the
+    // mappings, a writer unpublishes a mapping and retires it, and the mapping is freed once every reader
+    // pinned at or before the epoch it was retired in is gone. Readers never wait for writers and only
+    // write to their own cache line.
+    class Epoch {
+    public:
+        Epoch();
+        // frees all that is retired, no reader may be left.
+        ~Epoch();
+        // returns the slot to give back to unpin.
+        uint32_t pin();
+        void unpin(uint32_t slot);
+        // free runs once no reader can see what was unpublished before this call.
+        void retire(std::function<void()> free);
+        // true when nothing retired is left.
+        bool reclaim();
+
+    private:
+        struct Slot {
+            // 0 when free, else the pinned epoch.
+            std::atomic<uint64_t> epoch;
+            // one cache line each.
+            uint8_t padding[64 - sizeof(std::atomic<uint64_t>)];
+        };
+        Slot slots_[EPOCH_SLOTS];
+        std::atomic<uint64_t> epoch_;
+        std::mutex retired_lock_;
+        std::vector<std::pair<uint64_t, std::function<void()>>> retired_;
+    };
+
+    class EpochGuard {
+    public:
+        explicit EpochGuard(Epoch& epoch): epoch_(epoch), slot_(epoch.pin()){
+        }
+        ~EpochGuard(){
+            epoch_.unpin(slot_);
+        }
+    private:
+        Epoch& epoch_;
+        uint32_t slot_;
+    };
+}
+
+#endif //EMO_EPOCH_H
@@ -4,74 +4,293 @@
 
 #include "KV.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <utility>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <thread>
 #include <vector>
 #include <dirent.h>
-#include "util/log.h"
 #include "util/fs.h"
+#include "util/log.h"
 
 namespace EmoKV {
+    namespace {
+        class MaintainScope {
+        public:
+            explicit MaintainScope(std::atomic<uint32_t>& seq): seq_(seq){
+                seq_.fetch_add(1);
+            }
+            ~MaintainScope(){
+                seq_.fetch_add(1);
+            }
+        private:
+            std::atomic<uint32_t>& seq_;
+        };
+
+        // takes the stripes in ascending order, so that two passes holding several never deadlock.
+        class StripesLock {
+        public:
+            StripesLock(std::mutex* locks, uint32_t count): locks_(locks){
+                for(uint32_t i = 0; i < count; i++){
+                    stripes_.push_back(i);
+                }
+                lock();
+            }
+            StripesLock(std::mutex* locks, std::vector<uint32_t> stripes): locks_(locks), stripes_(std::move(stripes)){
+                std::sort(stripes_.begin(), stripes_.end());
+                stripes_.erase(std::unique(stripes_.begin(), stripes_.end()), stripes_.end());
+                lock();
+            }
+            ~StripesLock(){
+                for(size_t i = stripes_.size(); i > 0; i--){
+                    locks_[stripes_[i - 1]].unlock();
+                }
+            }
+        private:
+            std::mutex* locks_;
+            std::vector<uint32_t> stripes_;
+            void lock(){
+                for(uint32_t stripe : stripes_){
+                    locks_[stripe].lock();
+                }
+            }
+        };
+
+        const uint64_t STRIPE_SEED = 0x2545F4914F6CDD1Dull;
+        // keys are routed with a fixed seed, a key stays in its shard across runs.
+        const uint64_t SHARD_SEED = 0x9E3779B97F4A7C15ull;
+        // the smallest key file a compaction makes, one page.
+        const uint64_t KEY_MIN_SPACE = 4096;
+        // the keys a compaction may write again with the writers stopped, and the rounds it takes at most
+        // to get the log down to that while they go on. it gives up past that, see compact_files.
+        const size_t COMPACT_LOCKED_REPLAY_MAX = 4096;
+        const uint32_t COMPACT_REPLAY_ROUNDS = 8;
+        // a compaction that would get back fewer dead bytes is skipped, even an explicit one.
+        const uint64_t COMPACT_MIN_GAIN = 64 * 1024;
+        // address space kept after a key or value file to grow it in place. none on 32 bits, where
+        // there's little of it: the storages are mapped again as they grow there.
+        const size_t STORAGE_RESERVE_SPACE = sizeof(void*) >= 8 ? 256 * 1024 * 1024 : 0;
+
+        // the space for a key or value file of size, see Value::grow.
+        size_t reserve_for(size_t size){
+            return STORAGE_RESERVE_SPACE == 0 ? 0 : std::max<size_t>(STORAGE_RESERVE_SPACE, size * 4);
+        }
+
+        Value* map_storage(const std::string& path, size_t mini_space){
+            size_t file_size;
+            size_t reserved;
+            void* start = make_reserved_mmap(path, mini_space, reserve_for(mini_space), file_size, reserved);
+            return start != nullptr ? new Value(start, file_size, reserved) : nullptr;
+        }
+
+        // what an index item can hold the lengths of, value is null for a delete.
+        bool fits_item(Buf* key, Buf* value){
+            return key->len() <= INDEX_MAX_KEY_LEN && (value == nullptr || value->len() <= INDEX_MAX_VALUE_LEN);
+        }
+    }
+
     KV* KV::make(
             std::string& dir,
             size_t index_init_space,
             size_t key_init_space,
             size_t value_init_space,
             float hash_factor,
-            int update_count_to_auto_compact
+            float compact_garbage_ratio,
+            uint64_t compact_min_garbage,
+            uint32_t shard_count
     ) {
         std::unique_ptr<Meta> meta(new Meta(dir));
+        if(meta->shard_count() == 0 && shard_count > 1 && !isFileExist(meta->index_path())){
+            // only a new store is sharded, the stores written before keep opening as they are.
+            meta->updateShardCount(shard_count);
+        }
+        if(meta->shard_count() > 1){
+            shard_count = meta->shard_count();
+            std::vector<std::unique_ptr<KV>> shards;
+            for(uint32_t i = 0; i < shard_count; i++){
+                std::string shard_dir = dir + "/shard_" + std::to_string(i);
+                mkdir(shard_dir.c_str(), S_IRWXU);
+                KV* shard = KV::make(
+                        shard_dir,
+                        index_init_space / shard_count,
+                        std::max<size_t>(key_init_space / shard_count, 1),
+                        std::max<size_t>(value_init_space / shard_count, 1),
+                        hash_factor,
+                        compact_garbage_ratio,
+                        compact_min_garbage / shard_count
+                );
+                if(shard == nullptr){
+                    return nullptr;
+                }
+                shards.emplace_back(shard);
+            }
+            return new KV(std::move(meta), std::move(shards));
+        }
+
         size_t index_file_size;
+        index_init_space = std::max(index_init_space, Index::size_for(INDEX_MIN_CAPABILITY));
         void* index_start = make_mmap(meta->index_path(), index_init_space, index_file_size);
         if(index_start == nullptr){
             return nullptr;
         }
         std::unique_ptr<Index> index(new Index(index_start, index_file_size, IndexMode::MMAP));
 
-        size_t key_file_size;
-        void* key_start = make_mmap(meta->key_path(), key_init_space, key_file_size);
-        if(key_start == nullptr){
+        std::unique_ptr<Value> key(map_storage(meta->key_path(), key_init_space));
+        if(key == nullptr){
             return nullptr;
         }
-        std::unique_ptr<Value> key(new Value(key_start, key_file_size));
 
-        size_t value_file_size;
-        void* value_start = make_mmap(meta->value_path(), value_init_space, value_file_size);
-        if(value_start == nullptr){
+        if(index->is_legacy()){
+            // written by an older format: rehash it into a new index file.
+            // the old file is removed by the first MSG_CLEAN_FILES pass.
+            uint32_t capability = INDEX_MIN_CAPABILITY;
+            while (capability < index->capability()){
+                capability *= 2;
+            }
+            auto new_path = Meta::gen_index_path(meta->dir());
+            index_start = make_mmap(new_path, Index::size_for(capability), index_file_size);
+            if(index_start == nullptr){
+                return nullptr;
+            }
+            std::unique_ptr<Index> upgraded(new Index(index_start, index_file_size, IndexMode::MMAP));
+            upgraded->copy_from(key.get(), index.get());
+            meta->updateIndexPath(new_path);
+            index = std::move(upgraded);
+        }
+
+        std::unique_ptr<Index> old_index;
+        if(!meta->old_index_path().empty()){
+            // a migration was interrupted, it goes on from the start of the old index.
+            size_t old_index_file_size;
+            void* old_index_start = make_mmap(
+                    meta->old_index_path(), Index::size_for(INDEX_MIN_CAPABILITY), old_index_file_size);
+            if(old_index_start == nullptr){
+                return nullptr;
+            }
+            old_index.reset(new Index(old_index_start, old_index_file_size, IndexMode::MMAP));
+        }
+
+        std::unique_ptr<UndoLog> undo;
+        if(isFileExist(meta->undo_path())){
+            size_t undo_file_size;
+            void* undo_start = make_mmap(meta->undo_path(), UndoLog::size_for(0), undo_file_size);
+            if(undo_start == nullptr){
+                return nullptr;
+            }
+            undo.reset(new UndoLog(undo_start, undo_file_size));
+            if(undo->is_pending()){
+                // the process died in a batch, none of it is kept.
+                undo->rollback(index.get(), old_index.get());
+            }
+        }
+
+        uint32_t key_count = index->key_count() + (old_index != nullptr ? old_index->key_count() : 0);
+        std::unique_ptr<SortedKeys> sorted_keys(SortedKeys::open(meta->sorted_keys_path(), key_count));
+
+        std::unique_ptr<Value> value(map_storage(meta->value_path(), value_init_space));
+        if(value == nullptr){
             return nullptr;
         }
-        std::unique_ptr<Value> value(new Value(value_start, value_file_size));
+
+        std::unique_ptr<ValueBackup> value_backup;
+        if(isFileExist(meta->value_backup_path())){
+            size_t value_backup_file_size;
+            void* value_backup_start = make_mmap(
+                    meta->value_backup_path(), ValueBackup::size_for(), value_backup_file_size);
+            if(value_backup_start == nullptr){
+                return nullptr;
+            }
+            value_backup.reset(new ValueBackup(value_backup_start, value_backup_file_size));
+            if(value_backup->is_pending()){
+                // the process died overwriting a value, it keeps the one before.
+                value_backup->rollback(index.get(), old_index.get(), value.get());
+            }
+        }
         return new KV(
                 std::move(meta),
                 std::move(index),
+                std::move(old_index),
+                std::move(undo),
+                std::move(value_backup),
+                std::move(sorted_keys),
                 std::move(key),
                 std::move(value),
                 hash_factor,
-                update_count_to_auto_compact
+                compact_garbage_ratio,
+                compact_min_garbage
         );
     }
 
     KV::KV(
             std::unique_ptr<Meta> meta,
             std::unique_ptr<Index> index,
+            std::unique_ptr<Index> old_index,
+            std::unique_ptr<UndoLog> undo,
+            std::unique_ptr<ValueBackup> value_backup,
+            std::unique_ptr<SortedKeys> sorted_keys,
             std::unique_ptr<Value> key,
             std::unique_ptr<Value> value,
             float hash_factor,
-            int update_count_to_auto_compact
+            float compact_garbage_ratio,
+            uint64_t compact_min_garbage
     ) : meta_(std::move(meta)),
     index_(std::move(index)),
+    old_index_(std::move(old_index)),
     key_(std::move(key)),
     value_(std::move(value)),
+    generation_(nullptr),
+    key_reserved_(0),
+    value_reserved_(0),
+    free_space_(new FreeSpace()),
+    undo_(std::move(undo)),
+    value_backup_(std::move(value_backup)),
+    forced_moves_(0),
+    sorted_keys_(std::move(sorted_keys)),
     hash_factor(hash_factor),
-    reading_count_(0),
-    update_count_to_auto_compact(update_count_to_auto_compact){
+    compact_garbage_ratio(compact_garbage_ratio),
+    compact_min_garbage(compact_min_garbage){
+        // a migration interrupted under open cursors may have written past the positions of index_.
+        adopt_positions();
+        key_reserved_.store(index_->key_pos());
+        value_reserved_.store(index_->value_pos());
+        for(auto& seq : maintain_seq_){
+            seq.store(0);
+        }
+        index_->set_free_space(free_space_.get());
+        if(old_index_ != nullptr){
+            old_index_->set_free_space(free_space_.get());
+            msg_ |= MSG_MIGRATE;
+        }
+        rebuild_free_space();
+        publish();
         std::function<void()> func = [this]() {
             msg_runner();
         };
         msg_thread_ = std::move(std::thread(func));
     }
 
+    KV::KV(std::unique_ptr<Meta> meta, std::vector<std::unique_ptr<KV>> shards):
+    meta_(std::move(meta)),
+    shards_(std::move(shards)),
+    generation_(nullptr),
+    key_reserved_(0),
+    value_reserved_(0),
+    forced_moves_(0),
+    hash_factor(0),
+    compact_garbage_ratio(0),
+    compact_min_garbage(0){
+        for(auto& seq : maintain_seq_){
+            seq.store(0);
+        }
+        // no thread: the shards keep themselves.
+        msg_ = 0;
+    }
+
     KV::~KV(){
         {
             std::lock_guard<std::mutex> lock(msg_lock_);
@@ -81,134 +300,1055 @@ namespace EmoKV {
         if(msg_thread_.joinable()){
             msg_thread_.join();
         }
+        delete generation_.load();
     }
 
     std::unique_ptr<Buf> KV::Get(std::unique_ptr<Buf> key) {
-        auto v = reading_count_.load();
+        std::unique_ptr<Buf> ret;
+        bool found = Get(key.get(), [&ret](const uint8_t* data, size_t len) {
+            auto* copy_data = static_cast<uint8_t *>(malloc(len));
+            memcpy(copy_data, data, len);
+            ret.reset(new Buf(copy_data, len, true));
+        });
+        // the sink may have seen a torn value of a key deleted meanwhile.
+        if(!found){
+            ret.reset();
+        }
+        return ret;
+    }
+
+    bool KV::Get(Buf* key, const ValueSink& sink) {
+        if(!shards_.empty()){
+            return shard_of(key)->Get(key, sink);
+        }
+        // the mappings of the generation can't be freed while the sink runs.
+        EpochGuard guard(epoch_);
+        Generation* gen = generation_.load();
         while (true){
-            if(v == -1){
-                std::this_thread::yield();
-            }else{
-                if(reading_count_.compare_exchange_strong(v, v+1)){
-                    break;
-                }
+            // a key is published in index before it leaves old_index, so it's looked up in this order.
+            if((gen->old_index != nullptr && gen->old_index->read(gen->key, gen->value, key, sink)) ||
+               gen->index->read(gen->key, gen->value, key, sink)){
+                return true;
             }
+            // a newer generation may have the key migrated or its value past the end of these mappings.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            Generation* latest = generation_.load();
+            if(latest == gen){
+                return false;
+            }
+            gen = latest;
         }
-        auto ret = index_->read(key_.get(), value_.get(), key.get());
-        v = reading_count_.load();
+    }
 
-        reading_count_.fetch_add(-1);
-        return ret;
+    void KV::MultiGet(Buf** keys, size_t count, std::vector<uint8_t>& found, const MultiValueSink& sink) {
+        found.assign(count, 0);
+        if(!shards_.empty()){
+            std::vector<std::vector<Buf*>> parts(shards_.size());
+            std::vector<std::vector<size_t>> positions(shards_.size());
+            for(size_t i = 0; i < count; i++){
+                uint32_t shard = shard_index(keys[i]);
+                parts[shard].push_back(keys[i]);
+                positions[shard].push_back(i);
+            }
+            for(size_t s = 0; s < parts.size(); s++){
+                if(parts[s].empty()){
+                    continue;
+                }
+                auto& position = positions[s];
+                std::vector<uint8_t> part_found;
+                shards_[s]->MultiGet(parts[s].data(), parts[s].size(), part_found,
+                                     [&sink, &position](size_t i, const uint8_t* data, size_t len) {
+                    sink(position[i], data, len);
+                });
+                for(size_t i = 0; i < position.size(); i++){
+                    found[position[i]] = part_found[i];
+                }
+            }
+            return;
+        }
+        EpochGuard guard(epoch_);
+        Generation* gen = generation_.load();
+        while (true){
+            // as in Get, the keys still in old_index are found there first.
+            if(gen->old_index != nullptr){
+                gen->old_index->read_multi(gen->key, gen->value, keys, count, found, sink);
+            }
+            gen->index->read_multi(gen->key, gen->value, keys, count, found, sink);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            Generation* latest = generation_.load();
+            if(latest == gen || std::find(found.begin(), found.end(), 0) == found.end()){
+                return;
+            }
+            gen = latest;
+        }
     }
 
     bool KV::Put(std::unique_ptr<Buf> key, std::unique_ptr<Buf> value) {
-        bool write_failed = false;
-        {
-            std::lock_guard<std::mutex> lock(writing_lock_);
-            int ret = index_->write(key_.get(), value_.get(), key.get(), value.get());
-            if(ret == -1){
-                if(expand_value(true)){
-                    ret = index_->write(key_.get(), value_.get(), key.get(), value.get());
-                    write_failed = ret < 0;
-                }else{
+        if(!shards_.empty()){
+            return shard_of(key.get())->Put(std::move(key), std::move(value));
+        }
+        if(!fits_item(key.get(), value.get())){
+            return false;
+        }
+        // the storages are filled before writing_lock_ is taken, writers of other stripes go on meanwhile.
+        std::lock_guard<std::mutex> stripe(stripe_of(key.get()));
+        // a value that doesn't fit in the item is first written over the one it replaces.
+        uint64_t value_data = value->len() > sizeof(uint64_t) ? INDEX_NO_POS : 0;
+        uint64_t key_data = INDEX_NO_POS;
+        bool placed = false;
+        while (true){
+            int ret;
+            {
+                std::lock_guard<std::mutex> lock(writing_lock_);
+                ret = write_locked(key.get(), value.get(), key_data, value_data);
+            }
+            if(ret == -2){
+                // longer than that one, or a new key: it's appended.
+                if(!place(false, value.get(), value_data)){
+                    LOG_I("Put: expand value storage failed.");
+                    return false;
+                }
+                placed = true;
+                continue;
+            }
+            if(ret == 0){
+                if(sorted_keys_ != nullptr && sorted_keys_->add(key->ptr(), key->len())){
+                    merge_keys_later();
+                }
+                return true;
+            }
+            // a new key that doesn't fit in the item, the stripe keeps it new meanwhile.
+            if(ret != -1 || !place(true, key.get(), key_data)){
+                if(ret == -1){
                     LOG_I("Put: expand key storage failed.");
-                    write_failed = true;
                 }
-            } else if(ret == -2){
-                if(expand_value(false)){
-                    ret = index_->write(key_.get(), value_.get(), key.get(), value.get());
-                    write_failed = ret < 0;
-                }else{
-                    LOG_I("Put: expand value storage failed.");
-                    write_failed = true;
+                // no item points to the value placed, it's free again.
+                if(placed){
+                    free_space_->add(value_data, value->len());
                 }
+                return false;
             }
+        }
+    }
 
-            if(!write_failed){
-                if(index_->key_count() * 1.0 / index_->capability() > hash_factor){
-                    expand_index();
+    int KV::write_locked(Buf* key, Buf* value, uint64_t key_data, uint64_t value_data) {
+        Index* target = index_.get();
+        if(old_index_ != nullptr && cursors_ > 0){
+            if(old_index_->contains(key_.get(), key)){
+                target = old_index_.get();
+            }
+        }else if(old_index_ != nullptr && !old_index_->migrate_key_to(key_.get(), index_.get(), key)){
+            // the new index is full already, it can only grow once the migration is done.
+            migrate(old_index_->capability());
+        }
+        int ret = value_data == INDEX_NO_POS ? overwrite(target, key, value)
+                : target->write_at(key_.get(), key, value, key_data, value_data);
+        if(target != index_.get()){
+            adopt_positions();
+        }
+        log_compact(key);
+        if(ret == -3){
+            if(old_index_ != nullptr){
+                migrate(old_index_->capability());
+            }
+            if(old_index_ == nullptr && expand_index(true)){
+                ret = index_->write_at(key_.get(), key, value, key_data, value_data);
+            }
+        }
+        if(ret != 0){
+            return ret;
+        }
+        after_write(1);
+        return 0;
+    }
+
+    int KV::overwrite(Index* target, Buf* key, Buf* value) {
+        uint32_t item;
+        uint64_t pos;
+        uint64_t len;
+        // the bytes in place may be read by an open stream. a value longer than the backup holds is
+        // appended as well.
+        if(streams_ > 0 || !target->extent_of(key_.get(), key, item, pos, len) || len > UINT16_MAX ||
+           value->len() > len || !value_->contains(pos, len) || !prepare_value_backup()){
+            return -2;
+        }
+        value_backup_->begin(target == old_index_.get(), item, value_.get(), pos, value->len(),
+                             static_cast<uint16_t>(len));
+        target->overwrite_at(item, value_.get(), value);
+        value_backup_->end();
+        // only once the backup ended: a rollback would give the bytes past the value back to the item.
+        if(value->len() < len){
+            free_space_->add(pos + value->len(), len - value->len());
+        }
+        return 0;
+    }
+
+    void KV::log_compact(Buf* key) {
+        if(compact_log_ != nullptr){
+            compact_log_->emplace(reinterpret_cast<const char*>(key->ptr()), key->len());
+        }
+    }
+
+    void KV::after_write(uint32_t writes) {
+        if(old_index_ != nullptr){
+            if(cursors_ == 0){
+                migrate(MIGRATE_ITEMS_PER_PUT * writes);
+            }else if((index_->key_count() + old_index_->key_count() + index_->tombstone_count()) * 1.0 /
+                     index_->capability() > hash_factor){
+                // the items held back would soon no longer fit, they are moved under the cursors so that
+                // the index can grow again, as by reserve_index.
+                migrate(old_index_->capability());
+            }
+        }else if(index_->key_count() * 1.0 / index_->capability() > hash_factor){
+            expand_index(true);
+        }else if((index_->key_count() + index_->tombstone_count()) * 1.0 / index_->capability() > hash_factor){
+            // mostly tombstones: rebuild at the same size to get the empty items back.
+            expand_index(false);
+        }
+
+        uint64_t total;
+        uint64_t dead = dead_bytes(total);
+        if(dead >= compact_min_garbage && dead >= total * compact_garbage_ratio){
+            std::lock_guard<std::mutex> msg_lock(msg_lock_);
+            if((msg_ & MSG_COMPACT) == 0){
+                msg_ |= MSG_COMPACT;
+                msg_cond_.notify_all();
+            }
+        }
+    }
+
+    void KV::adopt_positions() {
+        if(old_index_ == nullptr){
+            return;
+        }
+        if(old_index_->key_pos() > index_->key_pos()){
+            index_->update_key_pos(old_index_->key_pos());
+        }
+        if(old_index_->value_pos() > index_->value_pos()){
+            index_->update_value_pos(old_index_->value_pos());
+        }
+    }
+
+    // the items of old_index_ count too, the positions are index_'s since it took them over.
+    uint64_t KV::dead_bytes(uint64_t& total) {
+        uint64_t live = index_->live_key_bytes() + index_->live_value_bytes();
+        if(old_index_ != nullptr){
+            live += old_index_->live_key_bytes() + old_index_->live_value_bytes();
+        }
+        total = index_->key_pos() + index_->value_pos();
+        return total > live ? total - live : 0;
+    }
+
+    uint32_t KV::stripe_index(Buf* key) {
+        return static_cast<uint32_t>(key->hash(STRIPE_SEED) & (WRITE_STRIPES - 1));
+    }
+
+    std::mutex& KV::stripe_of(Buf* key) {
+        return stripe_locks_[stripe_index(key)];
+    }
+
+    Value* KV::storage_for(bool is_key, uint64_t end) {
+        // the storage can't be swapped for another file while a stripe is held, only grown.
+        Generation* gen = generation_.load();
+        Value* storage = is_key ? gen->key : gen->value;
+        if(end > storage->size()){
+            {
+                std::lock_guard<std::mutex> lock(grow_lock_);
+                if(!expand_value(is_key, end)){
+                    return nullptr;
                 }
+            }
+            gen = generation_.load();
+            storage = is_key ? gen->key : gen->value;
+        }
+        return storage;
+    }
 
-                if(index_->updated_count() > update_count_to_auto_compact){
-                    std::lock_guard<std::mutex> msg_lock(msg_lock_);
-                    // double check
-                    if(index_->updated_count() > update_count_to_auto_compact){
-                        msg_ |= MSG_COMPACT;
-                        msg_cond_.notify_all();
-                    }
+    bool KV::place(bool is_key, Buf* data, uint64_t& pos) {
+        // the dead extents are in the file in place, which a compaction only swaps under all the stripes.
+        if(is_key || !free_space_->take(data->len(), pos)){
+            pos = (is_key ? key_reserved_ : value_reserved_).fetch_add(data->len());
+        }
+        EpochGuard guard(epoch_);
+        Value* storage = storage_for(is_key, pos + data->len());
+        if(storage != nullptr && storage->put(pos, data->ptr(), data->len()) == 0){
+            return true;
+        }
+        if(!is_key){
+            free_space_->add(pos, data->len());
+        }
+        return false;
+    }
+
+    bool KV::place_all(bool is_key, const std::vector<Buf*>& data, std::vector<uint64_t>& pos) {
+        EpochGuard guard(epoch_);
+        std::vector<Buf*> rest(data);
+        // the value extents placed so far, free again if the rest can't be placed.
+        std::vector<std::pair<uint64_t, uint64_t>> placed;
+        bool ok = true;
+        uint64_t total = 0;
+        for(size_t i = 0; i < rest.size() && ok; i++){
+            if(rest[i] == nullptr){
+                continue;
+            }
+            if(!is_key && free_space_->take(rest[i]->len(), pos[i])){
+                placed.emplace_back(pos[i], rest[i]->len());
+                Value* storage = storage_for(false, pos[i] + rest[i]->len());
+                ok = storage != nullptr && storage->put(pos[i], rest[i]->ptr(), rest[i]->len()) == 0;
+                rest[i] = nullptr;
+                continue;
+            }
+            total += rest[i]->len();
+        }
+        if(ok && total > 0){
+            uint64_t next = (is_key ? key_reserved_ : value_reserved_).fetch_add(total);
+            placed.emplace_back(next, total);
+            Value* storage = storage_for(is_key, next + total);
+            ok = storage != nullptr;
+            for(size_t i = 0; i < rest.size() && ok; i++){
+                if(rest[i] == nullptr){
+                    continue;
                 }
+                ok = storage->put(next, data[i]->ptr(), data[i]->len()) == 0;
+                pos[i] = next;
+                next += data[i]->len();
+            }
+        }
+        if(!ok && !is_key){
+            for(auto& extent : placed){
+                free_space_->add(extent.first, extent.second);
+            }
+        }
+        return ok;
+    }
+
+    void KV::free_values(const std::vector<Buf*>& values, const std::vector<uint64_t>& pos) {
+        for(size_t i = 0; i < values.size(); i++){
+            if(values[i] != nullptr){
+                free_space_->add(pos[i], values[i]->len());
             }
         }
-        return !write_failed;
     }
 
     void KV::Del(std::unique_ptr<Buf> key) {
+        if(!shards_.empty()){
+            shard_of(key.get())->Del(std::move(key));
+            return;
+        }
+        std::lock_guard<std::mutex> stripe(stripe_of(key.get()));
         {
             std::lock_guard<std::mutex> lock(writing_lock_);
+            if(old_index_ != nullptr){
+                old_index_->del(key_.get(), key.get());
+            }
             index_->del(key_.get(), key.get());
+            log_compact(key.get());
+            // the bytes of the value are dead now, and the tombstone may call for a rebuild.
+            after_write(1);
+        }
+        // under the stripe, so that a Put of the key that follows changes it after.
+        if(sorted_keys_ != nullptr && sorted_keys_->remove(key->ptr(), key->len())){
+            merge_keys_later();
+        }
+    }
+
+    bool KV::Write(WriteBatch& batch) {
+        if(!shards_.empty()){
+            std::vector<WriteBatch> parts(shards_.size());
+            for(auto& op : batch.ops()){
+                uint32_t shard = shard_index(op.key.get());
+                parts[shard].add(std::move(op));
+            }
+            bool ret = true;
+            for(size_t i = 0; i < parts.size(); i++){
+                if(!parts[i].empty() && !shards_[i]->Write(parts[i])){
+                    ret = false;
+                }
+            }
+            return ret;
+        }
+        auto& ops = batch.ops();
+        if(ops.empty()){
+            return true;
+        }
+        std::vector<uint32_t> stripes;
+        stripes.reserve(ops.size());
+        bool deletes_long_key = false;
+        for(auto& op : ops){
+            if(!fits_item(op.key.get(), op.value.get())){
+                return false;
+            }
+            stripes.push_back(stripe_index(op.key.get()));
+            deletes_long_key |= op.value == nullptr && op.key->len() > INDEX_INLINE_KEY_LEN;
+        }
+        StripesLock stripes_lock(stripe_locks_, std::move(stripes));
+
+        // the stripes keep the keys of the batch as they are, so what's new is known before any write.
+        // a long key deleted by the batch may be put again after, then it needs its bytes as well.
+        std::vector<Buf*> values(ops.size(), nullptr);
+        std::vector<Buf*> keys(ops.size(), nullptr);
+        std::vector<uint64_t> value_data(ops.size(), 0);
+        std::vector<uint64_t> key_data(ops.size(), INDEX_NO_POS);
+        uint32_t new_count = 0;
+        {
+            // only the lookups, the storages are filled with the lock released.
+            std::lock_guard<std::mutex> lock(writing_lock_);
+            for(size_t i = 0; i < ops.size(); i++){
+                Buf* key = ops[i].key.get();
+                Buf* value = ops[i].value.get();
+                if(value == nullptr){
+                    continue;
+                }
+                if(value->len() > sizeof(uint64_t)){
+                    values[i] = value;
+                }
+                bool is_new = !(old_index_ != nullptr && old_index_->contains(key_.get(), key)) &&
+                        !index_->contains(key_.get(), key);
+                new_count += is_new ? 1 : 0;
+                if((is_new || deletes_long_key) && key->len() > INDEX_INLINE_KEY_LEN){
+                    keys[i] = key;
+                }
+            }
         }
+        if(!place_all(false, values, value_data)){
+            return false;
+        }
+        if(!place_all(true, keys, key_data)){
+            free_values(values, value_data);
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(writing_lock_);
+            // a put may move its key from old_index_ and then write it: two entries and one more.
+            if(!reserve_index(new_count) || !prepare_undo(static_cast<uint32_t>(ops.size()) * 3)){
+                free_values(values, value_data);
+                return false;
+            }
+            undo_->begin(index_.get(), old_index_.get());
+            free_space_->hold();
+            index_->set_undo(undo_.get());
+            if(old_index_ != nullptr){
+                old_index_->set_undo(undo_.get());
+            }
+            bool written = true;
+            for(size_t i = 0; i < ops.size() && written; i++){
+                Buf* key = ops[i].key.get();
+                Buf* value = ops[i].value.get();
+                if(value == nullptr){
+                    if(old_index_ != nullptr){
+                        old_index_->del(key_.get(), key);
+                    }
+                    index_->del(key_.get(), key);
+                    continue;
+                }
+                Index* target = index_.get();
+                if(old_index_ != nullptr && cursors_ > 0){
+                    target = old_index_->contains(key_.get(), key) ? old_index_.get() : target;
+                }else if(old_index_ != nullptr){
+                    written = old_index_->migrate_key_to(key_.get(), index_.get(), key);
+                }
+                written = written && target->write_at(key_.get(), key, value, key_data[i], value_data[i]) == 0;
+            }
+            index_->set_undo(nullptr);
+            if(old_index_ != nullptr){
+                old_index_->set_undo(nullptr);
+                adopt_positions();
+            }
+            for(auto& op : ops){
+                log_compact(op.key.get());
+            }
+            if(!written){
+                undo_->rollback(index_.get(), old_index_.get());
+                free_space_->release(false);
+                // the items point to the values they had before the batch again.
+                free_values(values, value_data);
+                return false;
+            }
+            undo_->end();
+            free_space_->release(true);
+            after_write(static_cast<uint32_t>(ops.size()));
+        }
+        // with writing_lock_ released, the stripes of the batch keep the keys meanwhile.
+        if(sorted_keys_ != nullptr){
+            bool merge = false;
+            for(auto& op : ops){
+                if(op.value != nullptr){
+                    merge |= sorted_keys_->add(op.key->ptr(), op.key->len());
+                }else{
+                    merge |= sorted_keys_->remove(op.key->ptr(), op.key->len());
+                }
+            }
+            if(merge){
+                merge_keys_later();
+            }
+        }
+        return true;
+    }
+
+    bool KV::reserve_index(uint32_t count) {
+        while (true){
+            uint32_t keys = index_->key_count() + count + (old_index_ != nullptr ? old_index_->key_count() : 0);
+            if((keys + index_->tombstone_count()) * 1.0 / index_->capability() <= hash_factor){
+                return true;
+            }
+            // the index grows from a complete one only.
+            if(old_index_ != nullptr){
+                migrate(old_index_->capability());
+            }
+            if(!expand_index(keys * 1.0 / index_->capability() > hash_factor)){
+                return false;
+            }
+        }
+    }
+
+    bool KV::prepare_undo(uint32_t capability) {
+        if(undo_ != nullptr && undo_->capability() >= capability){
+            return true;
+        }
+        size_t undo_file_size;
+        void* undo_start = make_mmap(meta_->undo_path(), UndoLog::size_for(capability), undo_file_size);
+        if(undo_start == nullptr){
+            return false;
+        }
+        // only read back by a rollback, nothing is pending between batches.
+        undo_.reset(new UndoLog(undo_start, undo_file_size));
+        return true;
+    }
+
+    void KV::rebuild_free_space() {
+        uint64_t live = index_->live_value_bytes() + (old_index_ != nullptr ? old_index_->live_value_bytes() : 0);
+        uint64_t end = index_->value_pos();
+        // not worth a walk over the index, as for a compaction.
+        if(end < live + COMPACT_MIN_GAIN){
+            return;
+        }
+        std::vector<std::pair<uint64_t, uint64_t>> extents;
+        index_->value_extents(extents);
+        if(old_index_ != nullptr){
+            old_index_->value_extents(extents);
+        }
+        free_space_->rebuild(extents, end);
+    }
+
+    bool KV::prepare_value_backup() {
+        if(value_backup_ != nullptr){
+            return true;
+        }
+        size_t file_size;
+        void* start = make_mmap(meta_->value_backup_path(), ValueBackup::size_for(), file_size);
+        if(start == nullptr){
+            return false;
+        }
+        value_backup_.reset(new ValueBackup(start, file_size));
+        return true;
+    }
+
+    Cursor* KV::NewCursor(bool keys_only) {
+        auto* cursor = new Cursor(this, keys_only);
+        if(!shards_.empty()){
+            for(auto& shard : shards_){
+                cursor->shards_.emplace_back(shard->NewCursor(keys_only));
+            }
+            return cursor;
+        }
+        std::lock_guard<std::mutex> lock(writing_lock_);
+        cursors_++;
+        cursor->forced_moves_ = forced_moves_.load();
+        Generation* gen = generation_.load();
+        cursor->parts_[0] = gen->old_index;
+        cursor->parts_[1] = gen->index;
+        return cursor;
+    }
+
+    void KV::close_cursor() {
+        std::lock_guard<std::mutex> lock(writing_lock_);
+        if(--cursors_ > 0){
+            return;
+        }
+        int msg = (old_index_ != nullptr ? MSG_MIGRATE : 0) | (compact_deferred_ ? MSG_COMPACT : 0);
+        compact_deferred_ = false;
+        if(msg != 0){
+            std::lock_guard<std::mutex> msg_lock(msg_lock_);
+            msg_ |= msg;
+            msg_cond_.notify_all();
+        }
+    }
+
+    ValueReader* KV::NewValueReader(Buf* key) {
+        if(!shards_.empty()){
+            return shard_of(key)->NewValueReader(key);
+        }
+        std::lock_guard<std::mutex> lock(writing_lock_);
+        // as in write_locked, a key still in old_index_ has its item there.
+        Index* target = old_index_ != nullptr && old_index_->contains(key_.get(), key) ? old_index_.get() : index_.get();
+        uint32_t item;
+        uint64_t pos = INDEX_NO_POS;
+        uint64_t len = 0;
+        uint8_t data[sizeof(uint64_t)];
+        if(!target->extent_of(key_.get(), key, item, pos, len) &&
+           !target->read(key_.get(), value_.get(), key, [&data, &len](const uint8_t* value, size_t value_len) {
+               memcpy(data, value, value_len);
+               len = value_len;
+           })){
+            return nullptr;
+        }
+        open_stream();
+        auto* reader = new ValueReader(this, pos, len);
+        if(pos == INDEX_NO_POS){
+            memcpy(reader->inline_, data, len);
+        }
+        return reader;
+    }
+
+    ValueWriter* KV::NewValueWriter(Buf* key, uint64_t len) {
+        if(!shards_.empty()){
+            return shard_of(key)->NewValueWriter(key, len);
+        }
+        if(key->len() > INDEX_MAX_KEY_LEN || len > INDEX_MAX_VALUE_LEN){
+            return nullptr;
+        }
+        {
+            // the storage stays the file in place from now on, see compact_files.
+            std::lock_guard<std::mutex> lock(writing_lock_);
+            open_stream();
+        }
+        uint64_t pos;
+        if(len == 0 || !free_space_->take(len, pos)){
+            pos = value_reserved_.fetch_add(len);
+        }
+        EpochGuard guard(epoch_);
+        if(storage_for(false, pos + len) == nullptr){
+            close_stream(INDEX_NO_POS, 0);
+            return nullptr;
+        }
+        return new ValueWriter(this, key, pos, len);
+    }
+
+    void KV::open_stream() {
+        streams_++;
+        free_space_->pin();
+    }
+
+    void KV::close_stream(uint64_t pos, uint64_t len) {
+        std::lock_guard<std::mutex> lock(writing_lock_);
+        if(pos != INDEX_NO_POS){
+            free_space_->add(pos, len);
+        }
+        free_space_->unpin();
+        if(--streams_ > 0 || cursors_ > 0 || !compact_deferred_){
+            return;
+        }
+        compact_deferred_ = false;
+        std::lock_guard<std::mutex> msg_lock(msg_lock_);
+        msg_ |= MSG_COMPACT;
+        msg_cond_.notify_all();
+    }
+
+    bool KV::commit_value(Buf* key, uint64_t pos, uint64_t len) {
+        std::lock_guard<std::mutex> stripe(stripe_of(key));
+        // a value that fits in the item is copied there from the storage.
+        EpochGuard guard(epoch_);
+        Buf value(generation_.load()->value->view(pos), len, false);
+        uint64_t key_data = INDEX_NO_POS;
+        while (true){
+            int ret;
+            {
+                std::lock_guard<std::mutex> lock(writing_lock_);
+                ret = write_locked(key, &value, key_data, pos);
+            }
+            if(ret != -1){
+                if(ret == 0 && sorted_keys_ != nullptr && sorted_keys_->add(key->ptr(), key->len())){
+                    merge_keys_later();
+                }
+                return ret == 0;
+            }
+            if(!place(true, key, key_data)){
+                return false;
+            }
+        }
+    }
+
+    void KV::ScanPrefix(Buf* prefix, bool keys_only, const EntrySink& sink) {
+        std::vector<std::string> keys;
+        prefix_keys(prefix, keys);
+        for(auto& k : keys){
+            Buf key(reinterpret_cast<const uint8_t*>(k.data()), k.size(), false);
+            if(keys_only){
+                // a key deleted since it was listed is checked for as well.
+                if(Get(&key, [](const uint8_t*, size_t) {})){
+                    sink(key.ptr(), key.len(), nullptr, 0);
+                }
+                continue;
+            }
+            // the sink of Get is called again after a concurrent write, the value is only handed on
+            // once it's read.
+            std::vector<uint8_t> value;
+            bool too_long = false;
+            bool found = Get(&key, [&value, &too_long](const uint8_t* data, size_t len) {
+                too_long = len > INDEX_MAX_SCAN_VALUE_LEN;
+                if(!too_long){
+                    value.assign(data, data + len);
+                }
+            });
+            if(found && !too_long){
+                sink(key.ptr(), key.len(), value.data(), value.size());
+            }
+        }
+    }
+
+    int64_t KV::DeletePrefix(Buf* prefix) {
+        std::vector<std::string> keys;
+        prefix_keys(prefix, keys);
+        WriteBatch batch;
+        for(auto& k : keys){
+            batch.del(reinterpret_cast<const uint8_t*>(k.data()), k.size());
+        }
+        if(!Write(batch)){
+            return -1;
+        }
+        return static_cast<int64_t>(keys.size());
+    }
+
+    void KV::prefix_keys(Buf* prefix, std::vector<std::string>& keys) {
+        if(!shards_.empty()){
+            for(auto& shard : shards_){
+                shard->prefix_keys(prefix, keys);
+            }
+            std::sort(keys.begin(), keys.end());
+            return;
+        }
+        std::lock_guard<std::mutex> lock(sorted_lock_);
+        SortedKeys* sorted = sorted_keys();
+        if(sorted != nullptr){
+            sorted->scan_prefix(prefix->ptr(), prefix->len(), keys);
+        }
+    }
+
+    SortedKeys* KV::sorted_keys() {
+        if(sorted_keys_ != nullptr){
+            return sorted_keys_.get();
+        }
+        // once for the store: the writers wait for a walk over the index.
+        StripesLock stripes(stripe_locks_, WRITE_STRIPES);
+        std::lock_guard<std::mutex> lock(writing_lock_);
+        std::vector<std::string> keys;
+        keys.reserve(index_->key_count() + (old_index_ != nullptr ? old_index_->key_count() : 0));
+        EntrySink collect = [&keys](const uint8_t* key, size_t key_len, const uint8_t*, size_t) {
+            keys.emplace_back(reinterpret_cast<const char*>(key), key_len);
+        };
+        for(Index* index : {old_index_.get(), index_.get()}){
+            if(index == nullptr){
+                continue;
+            }
+            uint32_t from = 0;
+            while (from < index->capability()){
+                index->scan(key_.get(), value_.get(), from, UINT32_MAX, true, collect);
+                if(from < index->capability()){
+                    // out of the storages, not written by any writer.
+                    from++;
+                }
+            }
+        }
+        sorted_keys_.reset(SortedKeys::build(meta_->sorted_keys_path(), keys));
+        return sorted_keys_.get();
     }
 
     void KV::Compact() {
+        for(auto& shard : shards_){
+            shard->Compact();
+        }
+        if(!shards_.empty()){
+            return;
+        }
         std::lock_guard<std::mutex> msg_lock(msg_lock_);
         msg_ |= MSG_COMPACT;
         msg_cond_.notify_all();
     }
 
-    bool KV::expand_index() {
+    void KV::merge_keys_later() {
+        std::lock_guard<std::mutex> msg_lock(msg_lock_);
+        if((msg_ & MSG_MERGE_KEYS) == 0){
+            msg_ |= MSG_MERGE_KEYS;
+            msg_cond_.notify_all();
+        }
+    }
+
+    uint32_t KV::MaintainSeq(int kind) const {
+        uint32_t seq = maintain_seq_[kind].load();
+        for(auto& shard : shards_){
+            seq += shard->MaintainSeq(kind);
+        }
+        return seq;
+    }
+
+    uint32_t KV::shard_index(Buf* key) {
+        uint64_t hash = key->hash(SHARD_SEED);
+        // maps the hash on [0, shard count) without a division.
+        return static_cast<uint32_t>(((hash >> 32) * shards_.size()) >> 32);
+    }
+
+    KV* KV::shard_of(Buf* key) {
+        return shards_[shard_index(key)].get();
+    }
+
+    // The items are not copied here: the new index takes over the writes while old_index_ is
+    // migrated into it a few items at a time, by each Put and by msg_runner, so that no single
+    // call pays for the whole index.
+    bool KV::expand_index(bool grow) {
+        MaintainScope scope(maintain_seq_[MAINTAIN_EXPAND_INDEX]);
         size_t index_file_size;
         auto new_path = Meta::gen_index_path(meta_->dir());
-        void* index_start = make_mmap(new_path, index_->size() * 2, index_file_size);
+        uint32_t capability = grow ? index_->capability() * 2 : index_->capability();
+        void* index_start = make_mmap(new_path, Index::size_for(capability), index_file_size);
         if(index_start == nullptr){
             return false;
         }
         std::unique_ptr<Index> index(new Index(index_start, index_file_size, IndexMode::MMAP));
-        index->copy_from(key_.get(), index_.get());
-        while (true){
-            auto zero = 0;
-            if(reading_count_.compare_exchange_strong(zero, -1)){
-                meta_->updateIndexPath(new_path);
-                index_ = std::move(index);
-                reading_count_.store(0);
-                std::lock_guard<std::mutex> msg_lock(msg_lock_);
-                msg_ |= MSG_CLEAN_FILES;
-                msg_cond_.notify_all();
-                break;
-            }
-            std::this_thread::yield();
+        index->inherit_from(index_.get());
+        index->set_free_space(free_space_.get());
+        meta_->updateIndexPath(new_path, meta_->index_path());
+        old_index_ = std::move(index_);
+        index_ = std::move(index);
+        publish();
+        migrate_pos_ = 0;
+        std::lock_guard<std::mutex> msg_lock(msg_lock_);
+        msg_ |= MSG_MIGRATE;
+        msg_cond_.notify_all();
+        return true;
+    }
+
+    bool KV::migrate(uint32_t count) {
+        MaintainScope scope(maintain_seq_[MAINTAIN_EXPAND_INDEX]);
+        if(cursors_ > 0){
+            // only a write that can't go on without it moves items under the open cursors.
+            forced_moves_.fetch_add(1);
+        }
+        if(!old_index_->migrate_to(key_.get(), index_.get(), migrate_pos_, count)){
+            return false;
         }
+        if(migrate_pos_ < old_index_->capability()){
+            return true;
+        }
+        meta_->updateIndexPath(meta_->index_path(), "");
+        std::unique_ptr<Index> migrated = std::move(old_index_);
+        publish();
+        retire(std::move(migrated));
+        std::lock_guard<std::mutex> msg_lock(msg_lock_);
+        msg_ |= MSG_CLEAN_FILES;
+        msg_cond_.notify_all();
         return true;
     }
 
-    bool KV::expand_value(bool is_key){
-        size_t file_size;
-        void* map_start;
-        if(is_key){
-            map_start = make_mmap(meta_->key_path(), key_->size() * 2, file_size);
-        }else{
-            map_start = make_mmap(meta_->value_path(), value_->size() * 2, file_size);
+    void KV::publish() {
+        auto* gen = new Generation{index_.get(), old_index_.get(), key_.get(), value_.get()};
+        Generation* last = generation_.exchange(gen);
+        if(last != nullptr){
+            epoch_.retire([last]() {
+                delete last;
+            });
+        }
+    }
+
+    template<typename T>
+    void KV::retire(std::unique_ptr<T> mapping) {
+        T* last = mapping.release();
+        epoch_.retire([last]() {
+            delete last;
+        });
+        // usually no reader is left by now, else msg_runner tries again later.
+        if(!epoch_.reclaim()){
+            std::lock_guard<std::mutex> msg_lock(msg_lock_);
+            msg_ |= MSG_RECLAIM;
+            msg_cond_.notify_all();
         }
+    }
 
-        if(map_start == nullptr){
+    bool KV::expand_value(bool is_key, uint64_t min_size){
+        std::unique_ptr<Value>& target = is_key ? key_ : value_;
+        if(min_size <= target->size()){
+            // grown by another writer meanwhile.
+            return true;
+        }
+        MaintainScope scope(maintain_seq_[is_key ? MAINTAIN_EXPAND_KEY : MAINTAIN_EXPAND_VALUE]);
+        size_t size = std::max<size_t>(target->size() * 2, min_size);
+        const std::string& path = is_key ? meta_->key_path() : meta_->value_path();
+        // in its reserved space the mapping stays where it is, nobody needs to know.
+        if(target->grow(path, size)){
+            return true;
+        }
+        std::unique_ptr<Value> storage(map_storage(path, size));
+        if(storage == nullptr){
             return false;
         }
 
-        while (true){
-            auto zero = 0;
-            if(reading_count_.compare_exchange_strong(zero, -1)){
-                if(is_key){
-                    key_ = std::unique_ptr<Value>(new Value(map_start, file_size));
-                }else{
-                    value_ = std::unique_ptr<Value>(new Value(map_start, file_size));
+        std::lock_guard<std::mutex> lock(writing_lock_);
+        std::unique_ptr<Value> last = std::move(target);
+        target = std::move(storage);
+        publish();
+        retire(std::move(last));
+        return true;
+    }
+
+    // The items of index_ are copied into new files with no lock held, the writers go on in the files in
+    // place meanwhile and log the keys they write. Under the locks at the end the logged keys are written
+    // again into the copy as they are then, which takes as long as the log, not the store.
+    bool KV::compact_files(int& next_msg) {
+        // the mappings copied from stay valid even if the writers grow the storages.
+        EpochGuard guard(epoch_);
+        Index* from;
+        Value* from_key;
+        Value* from_value;
+        uint32_t forced_moves;
+        {
+            std::lock_guard<std::mutex> lock(writing_lock_);
+            // the walks of open cursors and the open streams rely on the files in place, the last one to
+            // close posts it again.
+            compact_deferred_ = cursors_ > 0 || streams_ > 0;
+            if(compact_deferred_ || old_index_ != nullptr){
+                return false;
+            }
+            uint64_t total;
+            if(dead_bytes(total) < COMPACT_MIN_GAIN){
+                return false;
+            }
+            from = index_.get();
+            from_key = key_.get();
+            from_value = value_.get();
+            // held like a cursor: the items stay in from, the writers update them in place.
+            cursors_++;
+            forced_moves = forced_moves_.load();
+            compact_log_.reset(new std::unordered_set<std::string>());
+        }
+        MaintainScope scope(maintain_seq_[MAINTAIN_COMPACT]);
+        auto new_index_path = Meta::gen_index_path(meta_->dir());
+        auto new_key_path = Meta::gen_key_path(meta_->dir());
+        auto new_value_path = Meta::gen_value_path(meta_->dir());
+        std::unique_ptr<Index> index;
+        std::unique_ptr<Value> key;
+        std::unique_ptr<Value> value;
+        size_t file_size;
+        void* start = make_mmap(new_index_path, Index::size_for(from->capability()), file_size);
+        if(start != nullptr){
+            index.reset(new Index(start, file_size, IndexMode::MMAP));
+            index->copy_from(from_key, from);
+            value.reset(map_storage(new_value_path, from_value->size()));
+        }
+        if(value != nullptr){
+            // the keys get a file of their own size: the dead ones are all dropped, and a
+            // doubled key file never shrinks otherwise.
+            key.reset(map_storage(new_key_path, std::max<uint64_t>(index->live_key_bytes() * 2, KEY_MIN_SPACE)));
+        }
+        bool copied = key != nullptr && index->compact(from_value, value.get()) && index->compact_keys(from_key, key.get());
+        // the log is written again in rounds with no lock held, each one taking what was logged during the
+        // one before, until what's left is short enough to write under the locks. writers that keep up
+        // with the rounds don't let it shrink, then it's left to a later compaction.
+        size_t last_size = SIZE_MAX;
+        for(uint32_t round = 0; copied && round < COMPACT_REPLAY_ROUNDS; round++){
+            std::unique_ptr<std::unordered_set<std::string>> log(new std::unordered_set<std::string>());
+            {
+                std::lock_guard<std::mutex> lock(writing_lock_);
+                size_t size = compact_log_->size();
+                if(size <= COMPACT_LOCKED_REPLAY_MAX || size >= last_size || old_index_ != nullptr){
+                    break;
                 }
-                reading_count_.store(0);
-                break;
+                last_size = size;
+                std::swap(log, compact_log_);
+            }
+            copied = replay_compact_log(*log, index.get(), key, new_key_path, value, new_value_path);
+        }
+
+        // the extents are the ones of the file compacted, freed with no lock held as the mappings are.
+        std::unique_ptr<FreeSpace> free_space(new FreeSpace());
+        {
+            StripesLock stripes(stripe_locks_, WRITE_STRIPES);
+            std::lock_guard<std::mutex> lock(writing_lock_);
+            std::unique_ptr<std::unordered_set<std::string>> log = std::move(compact_log_);
+            // a cursor or a stream opened meanwhile, or items moved out of from by an expansion of the index.
+            if(cursors_ > 1 || streams_ > 0 || forced_moves_.load() != forced_moves || old_index_ != nullptr){
+                compact_deferred_ = true;
+                copied = false;
+            }
+            // the writers would stall for too long, the next auto compact tries again.
+            if(log->size() > COMPACT_LOCKED_REPLAY_MAX){
+                copied = false;
+            }
+            if(copied && replay_compact_log(*log, index.get(), key, new_key_path, value, new_value_path)){
+                meta_->updateAllPath(new_index_path, new_key_path, new_value_path);
+                std::swap(index_, index);
+                std::swap(key_, key);
+                std::swap(value_, value);
+                publish();
+                retire(std::move(index));
+                retire(std::move(key));
+                retire(std::move(value));
+                key_reserved_.store(index_->key_pos());
+                value_reserved_.store(index_->value_pos());
+                std::swap(free_space_, free_space);
+                index_->set_free_space(free_space_.get());
+            }
+            // what was held back meanwhile, as close_cursor does.
+            if(--cursors_ == 0){
+                next_msg |= (old_index_ != nullptr ? MSG_MIGRATE : 0) | (compact_deferred_ ? MSG_COMPACT : 0);
+                compact_deferred_ = false;
+            }
+        }
+        return true;
+    }
+
+    bool KV::replay_compact_log(const std::unordered_set<std::string>& log, Index* index,
+                                std::unique_ptr<Value>& key, const std::string& key_path,
+                                std::unique_ptr<Value>& value, const std::string& value_path) {
+        for(auto& k : log){
+            Buf key_buf(reinterpret_cast<const uint8_t*>(k.data()), k.size(), false);
+            int ret = 0;
+            bool found = Get(&key_buf, [&](const uint8_t* data, size_t len) {
+                Buf value_buf(data, len, false);
+                uint64_t value_data = 0;
+                if(len > sizeof(uint64_t)){
+                    value_data = index->value_pos();
+                    if(!grow_to(value, value_path, value_data + len) || value->put(value_data, data, len) != 0){
+                        ret = -2;
+                        return;
+                    }
+                }
+                uint64_t key_data = INDEX_NO_POS;
+                if(k.size() > INDEX_INLINE_KEY_LEN && !index->contains(key.get(), &key_buf)){
+                    key_data = index->key_pos();
+                    if(!grow_to(key, key_path, key_data + k.size()) ||
+                       key->put(key_data, key_buf.ptr(), key_buf.len()) != 0){
+                        ret = -1;
+                        return;
+                    }
+                }
+                ret = index->write_at(key.get(), &key_buf, &value_buf, key_data, value_data);
+            });
+            if(!found){
+                index->del(key.get(), &key_buf);
+            }
+            if(ret != 0){
+                return false;
             }
-            std::this_thread::yield();
         }
         return true;
     }
 
+    bool KV::grow_to(std::unique_ptr<Value>& storage, const std::string& path, uint64_t end) {
+        if(end <= storage->size()){
+            return true;
+        }
+        size_t size = std::max<uint64_t>(storage->size() * 2, end);
+        if(storage->grow(path, size)){
+            return true;
+        }
+        Value* grown = map_storage(path, size);
+        if(grown == nullptr){
+            return false;
+        }
+        storage.reset(grown);
+        return true;
+    }
+
     void KV::msg_runner() {
         while (true){
             int local_msg;
@@ -224,37 +1364,29 @@ namespace EmoKV {
                 break;
             }
 
-            if((local_msg & MSG_COMPACT) == MSG_COMPACT){
-                std::lock_guard<std::mutex> lock(writing_lock_);
-                size_t index_file_size;
-                auto new_index_path = Meta::gen_index_path(meta_->dir());
-                auto new_value_path = Meta::gen_value_path(meta_->dir());
-                void* index_start = make_mmap(new_index_path, index_->size(), index_file_size);
-                if(index_start != nullptr){
-                    std::unique_ptr<Index> index(new Index(index_start, index_file_size, IndexMode::MMAP));
-                    index->copy_from(key_.get(), index_.get());
-
-                    size_t value_file_size;
-                    void* value_start = make_mmap(new_value_path, value_->size(), value_file_size);
-                    if(value_start != nullptr){
-                        std::unique_ptr<Value> value(new Value(value_start, value_file_size));
-                        index->compact(value_.get(), value.get());
-                        while (true){
-                            auto zero = 0;
-                            if(reading_count_.compare_exchange_strong(zero, -1)){
-                                meta_->updateAllPath(new_index_path, meta_->key_path(), new_value_path);
-                                index_ = std::move(index);
-                                value_ = std::move(value);
-                                local_msg |= MSG_CLEAN_FILES;
-                                reading_count_.store(0);
-                                break;
-                            }
-                            std::this_thread::yield();
+            // only index_ is compacted, so a migration left is done first.
+            if((local_msg & (MSG_MIGRATE | MSG_COMPACT)) != 0){
+                // a pass at a time, so that writers get the lock in between.
+                while (true){
+                    {
+                        std::lock_guard<std::mutex> lock(msg_lock_);
+                        if((msg_ & MSG_EXIT) == MSG_EXIT){
+                            break;
                         }
                     }
+                    std::lock_guard<std::mutex> lock(writing_lock_);
+                    if(old_index_ == nullptr || cursors_ > 0 || !migrate(MIGRATE_ITEMS_PER_PASS)){
+                        break;
+                    }
                 }
             }
 
+            // what a pass holds back for later, posted again once local_msg is cleared.
+            int next_msg = 0;
+            if((local_msg & MSG_COMPACT) == MSG_COMPACT && compact_files(next_msg)){
+                local_msg |= MSG_CLEAN_FILES;
+            }
+
             if((local_msg & MSG_CLEAN_FILES) == MSG_CLEAN_FILES){
                 DIR *dir = opendir(meta_->dir().c_str());
                 if(dir){
@@ -266,9 +1398,15 @@ namespace EmoKV {
                             if(strcmp(ptr->d_name, ".") != 0 && strcmp(ptr->d_name, "..") != 0){
                                 std::string path = meta_->dir() + "/" + ptr->d_name;
                                 if(path != meta_->meta_path() &&
+                                   path != meta_->temp_path() &&
                                    path != meta_->key_path() &&
                                    path != meta_->value_path() &&
-                                   path != meta_->index_path()){
+                                   path != meta_->index_path() &&
+                                   path != meta_->old_index_path() &&
+                                   path != meta_->undo_path() &&
+                                   path != meta_->value_backup_path() &&
+                                   path != meta_->sorted_keys_path() &&
+                                   path != SortedKeys::temp_path(meta_->sorted_keys_path())){
                                     paths.push_back(std::move(path));
                                 }
                             }
@@ -281,8 +1419,32 @@ namespace EmoKV {
                 }
             }
 
+            if((local_msg & MSG_MERGE_KEYS) == MSG_MERGE_KEYS){
+                SortedKeys* sorted;
+                {
+                    // once built, sorted_keys_ stays until the store is closed.
+                    std::lock_guard<std::mutex> lock(sorted_lock_);
+                    sorted = sorted_keys_.get();
+                }
+                if(sorted != nullptr){
+                    sorted->merge_changes();
+                }
+            }
+
+            bool reclaimed = true;
+            if((local_msg & MSG_RECLAIM) == MSG_RECLAIM && !epoch_.reclaim()){
+                // readers still hold an older generation, they are short: try again a bit later.
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                reclaimed = epoch_.reclaim();
+            }
+
             std::unique_lock<std::mutex> lock(msg_lock_);
-            msg_ = 0;
+            // keep what was posted meanwhile, MSG_EXIT from the destructor above all.
+            msg_ &= ~local_msg;
+            msg_ |= next_msg;
+            if(!reclaimed){
+                msg_ |= MSG_RECLAIM;
+            }
         }
     }
 }
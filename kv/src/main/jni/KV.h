@@ -5,62 +5,245 @@
 #ifndef EMO_KV_H
 #define EMO_KV_H
 #include <string>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <thread>
+#include <vector>
 #include "Buf.h"
+#include "Epoch.h"
+#include "WriteBatch.h"
+#include "Cursor.h"
+#include "ValueStream.h"
 #include "data/Meta.h"
+#include "data/FreeSpace.h"
 #include "data/Index.h"
+#include "data/SortedKeys.h"
+#include "data/UndoLog.h"
 #include "data/Value.h"
+#include "data/ValueBackup.h"
 
 namespace EmoKV {
 
     static const int MSG_EXIT = 0x1;
     static const int MSG_COMPACT = 0x2;
     static const int MSG_CLEAN_FILES = 0X4;
+    static const int MSG_MIGRATE = 0x8;
+    static const int MSG_RECLAIM = 0x10;
+    static const int MSG_MERGE_KEYS = 0x20;
+
+    // index items moved to the new index by each Put while it's growing, and by each pass of msg_runner.
+    static const uint32_t MIGRATE_ITEMS_PER_PUT = 64;
+    static const uint32_t MIGRATE_ITEMS_PER_PASS = 4096;
+
+    // writers of keys in different stripes only share writing_lock_, for the time to write an index item.
+    static const uint32_t WRITE_STRIPES = 64;
+
+    // Maintenance passes that may stall Get/Put, observable through KV::MaintainSeq.
+    static const int MAINTAIN_EXPAND_INDEX = 0;
+    static const int MAINTAIN_EXPAND_KEY = 1;
+    static const int MAINTAIN_EXPAND_VALUE = 2;
+    static const int MAINTAIN_COMPACT = 3;
+    static const int MAINTAIN_KIND_COUNT = 4;
+
+    // The mappings a reader uses together, swapped as a whole by publishing a new generation.
+    struct Generation {
+        Index* index;
+        Index* old_index;
+        Value* key;
+        Value* value;
+    };
 
     class KV {
     public:
+        friend class Cursor;
+        friend class ValueReader;
+        friend class ValueWriter;
         static KV* make(
                 std::string& dir,
                 size_t index_init_space,
                 size_t key_init_space,
                 size_t value_init_space,
                 float hash_factor,
-                int update_count_to_auto_compact
+                // auto compaction runs once the dead bytes of the key and value storages are this part of
+                // them, and at least compact_min_garbage.
+                float compact_garbage_ratio,
+                uint64_t compact_min_garbage,
+                // a new store is split in this many independent shards, an existing one keeps its count.
+                uint32_t shard_count = 1
         );
         ~KV();
 
         std::unique_ptr<Buf> Get(std::unique_ptr<Buf> key);
+        // copies the value once from the mapping through the sink, returns false if absent. what the sink
+        // got is dropped then, see ValueSink.
+        bool Get(Buf* key, const ValueSink& sink);
+        // looks all the keys up together, sink gets the index in keys of each value found. found[i] tells
+        // whether keys[i] was found in the end, what the sink got for the others is dropped, see ValueSink.
+        void MultiGet(Buf** keys, size_t count, std::vector<uint8_t>& found, const MultiValueSink& sink);
 
+        // false for a key longer than INDEX_MAX_KEY_LEN or a value longer than INDEX_MAX_VALUE_LEN.
         bool Put(std::unique_ptr<Buf> key, std::unique_ptr<Buf> value);
         void Del(std::unique_ptr<Buf> key);
+        // applies the ops in order under one lock: after a crash the store has either all of them or none.
+        // a sharded store only keeps that per shard. false when a shard can't write its part, which it
+        // drops as a whole then.
+        bool Write(WriteBatch& batch);
+        // rewrites the storages without their dead bytes in the background, unless there are few of them.
         void Compact();
+        // walks the live items in chunks, see Cursor. it must be deleted before this KV.
+        Cursor* NewCursor(bool keys_only);
+        // streams the value of key a chunk at a time, null if absent. see ValueStream.h.
+        ValueReader* NewValueReader(Buf* key);
+        // places len bytes for the value of key, which it's given by ValueWriter::Commit. null if they
+        // can't be placed, or the key or len are too long as for Put.
+        ValueWriter* NewValueWriter(Buf* key, uint64_t len);
+        // the entries whose keys start with prefix, in key order, value is null when keys_only.
+        // the keys come from SortedKeys, which the first scan of a store builds from the index. unless
+        // keys_only, the entries with a value past INDEX_MAX_SCAN_VALUE_LEN are skipped, as by a Cursor.
+        void ScanPrefix(Buf* prefix, bool keys_only, const EntrySink& sink);
+        // deletes the keys that start with prefix as one batch, see Write. the count of them, -1 if it fails.
+        int64_t DeletePrefix(Buf* prefix);
+
+        // Odd while a maintenance pass of the kind is running, grows by 2 for every finished pass.
+        // summed over the shards of a sharded store.
+        uint32_t MaintainSeq(int kind) const;
 
     private:
         std::unique_ptr<Meta> meta_;
+        // a sharded store only routes the keys to its shards, each one is a KV of its own.
+        std::vector<std::unique_ptr<KV>> shards_;
         std::unique_ptr<Index> index_;
+        // the index being migrated into index_, readers look it up first, see expand_index.
+        std::unique_ptr<Index> old_index_;
+        uint32_t migrate_pos_ = 0;
         std::unique_ptr<Value> key_;
         std::unique_ptr<Value> value_;
-        std::atomic_int32_t reading_count_;
+        // what readers see, the unique_ptrs above are only used by writers.
+        std::atomic<Generation*> generation_;
+        Epoch epoch_;
+        std::atomic<uint32_t> maintain_seq_[MAINTAIN_KIND_COUNT];
         std::thread msg_thread_;
         int msg_ = MSG_CLEAN_FILES;
         std::condition_variable msg_cond_;
         std::mutex msg_lock_;
+        // guards the index and the mappings, the storages are filled before it's taken.
         std::mutex writing_lock_;
+        // a key is always written under the same stripe, passes rewriting the storages take them all.
+        std::mutex stripe_locks_[WRITE_STRIPES];
+        // serializes the growth of the key and value storages.
+        std::mutex grow_lock_;
+        // the end of the space placed in the key and value storages so far.
+        std::atomic<uint64_t> key_reserved_;
+        std::atomic<uint64_t> value_reserved_;
+        // the dead extents of value_ that place takes first, see FreeSpace. set under all the stripes.
+        std::unique_ptr<FreeSpace> free_space_;
+        // opened by the first batch, or on open to roll back one that a crash interrupted.
+        std::unique_ptr<UndoLog> undo_;
+        // opened by the first value written in place, or on open to put back one that a crash interrupted.
+        std::unique_ptr<ValueBackup> value_backup_;
+        // open cursors hold migration and compaction back, guarded by writing_lock_.
+        uint32_t cursors_ = 0;
+        // open value streams hold compaction and values written in place back, guarded by writing_lock_.
+        uint32_t streams_ = 0;
+        bool compact_deferred_ = false;
+        // bumped when items move under open cursors anyway, which breaks their walks.
+        std::atomic<uint32_t> forced_moves_;
+        // null until a prefix scan needs it. set under all the stripes and sorted_lock_, so either is
+        // enough to read it.
+        std::unique_ptr<SortedKeys> sorted_keys_;
+        std::mutex sorted_lock_;
+        // the keys written while compact_files copies, null otherwise. guarded by writing_lock_.
+        std::unique_ptr<std::unordered_set<std::string>> compact_log_;
         float hash_factor;
-        int update_count_to_auto_compact;
-        bool expand_value(bool is_key);
-        bool expand_index();
+        float compact_garbage_ratio;
+        uint64_t compact_min_garbage;
+        // grows the storage by doubling until it's at least min_size: in place while it fits in the address
+        // space reserved for it, else it's mapped again and published.
+        bool expand_value(bool is_key, uint64_t min_size);
+        uint32_t stripe_index(Buf* key);
+        std::mutex& stripe_of(Buf* key);
+        // reserves space for data in the key or value storage and copies it there. a value goes in a
+        // dead extent of the storage if there is one, which is free again if the copy fails.
+        bool place(bool is_key, Buf* data, uint64_t& pos);
+        // places all the non null data, pos[i] is set for data[i]. what doesn't go in dead extents is
+        // appended in one reservation. on failure the value extents placed are free again.
+        bool place_all(bool is_key, const std::vector<Buf*>& data, std::vector<uint64_t>& pos);
+        // gives the extents placed for values[i] at pos[i] back to free_space_, for a write that failed.
+        void free_values(const std::vector<Buf*>& values, const std::vector<uint64_t>& pos);
+        // the storage mapping that reaches end, grown if needed. the caller pins epoch_.
+        Value* storage_for(bool is_key, uint64_t end);
+        // writes the item with the data placed already, see Index::write_at. value_data is INDEX_NO_POS
+        // for a value to write over the one of the key, -2 when it doesn't fit there and must be placed.
+        // writing_lock_ must be held.
+        int write_locked(Buf* key, Buf* value, uint64_t key_data, uint64_t value_data);
+        // writes value over the one of key in the value storage when it's not longer, -2 else.
+        int overwrite(Index* target, Buf* key, Buf* value);
+        // index_ takes the storage positions of old_index_ that are past its own: the writes under open
+        // cursors go on in old_index_, and only the positions of index_ are kept once it's migrated.
+        void adopt_positions();
+        // the maintenance that follows `writes` writes: migration steps, load checks and auto compact.
+        void after_write(uint32_t writes);
+        // the bytes of the storages no item points to any more, out of total. writing_lock_ must be held.
+        uint64_t dead_bytes(uint64_t& total);
+        // notes a key written while compact_files runs. writing_lock_ must be held.
+        void log_compact(Buf* key);
+        // grows the index until count more keys fit below hash_factor. writing_lock_ must be held.
+        bool reserve_index(uint32_t count);
+        bool prepare_undo(uint32_t capability);
+        bool prepare_value_backup();
+        // the dead extents of value_ from the gaps between the live values, unless there are few.
+        void rebuild_free_space();
+        // grow doubles the capability, else the index is rebuilt at its size without tombstones.
+        bool expand_index(bool grow);
+        uint32_t shard_index(Buf* key);
+        KV* shard_of(Buf* key);
+        // moves up to count items of old_index_, drops it once empty. writing_lock_ must be held.
+        bool migrate(uint32_t count);
+        // publishes the current mappings to readers, the previous generation is retired.
+        void publish();
+        // frees a mapping that is unpublished already once no reader can see it.
+        template<typename T>
+        void retire(std::unique_ptr<T> mapping);
+        void close_cursor();
+        // pins free_space_ for a new stream. writing_lock_ must be held.
+        void open_stream();
+        // the extent at pos, unless it's INDEX_NO_POS, is added to free_space_ for later.
+        void close_stream(uint64_t pos, uint64_t len);
+        // writes the item of key for the value a stream wrote at pos.
+        bool commit_value(Buf* key, uint64_t pos, uint64_t len);
+        // false when it's held back, else it may have left files to clean. see next_msg in msg_runner.
+        bool compact_files(int& next_msg);
+        // writes the logged keys into index as they are now, the data goes to the end of key and value.
+        bool replay_compact_log(const std::unordered_set<std::string>& log, Index* index,
+                                std::unique_ptr<Value>& key, const std::string& key_path,
+                                std::unique_ptr<Value>& value, const std::string& value_path);
+        // remaps the storage file at path so that it reaches end.
+        static bool grow_to(std::unique_ptr<Value>& storage, const std::string& path, uint64_t end);
+        // the keys with the prefix in order, over all the shards.
+        void prefix_keys(Buf* prefix, std::vector<std::string>& keys);
+        // sorted_keys_, built if it's null. sorted_lock_ must be held.
+        SortedKeys* sorted_keys();
+        // the changes of sorted_keys_ are merged into its file by msg_runner, off the writers' path.
+        void merge_keys_later();
         void msg_runner();
         KV(
                 std::unique_ptr<Meta> meta,
                 std::unique_ptr<Index> index,
+                std::unique_ptr<Index> old_index,
+                std::unique_ptr<UndoLog> undo,
+                std::unique_ptr<ValueBackup> value_backup,
+                std::unique_ptr<SortedKeys> sorted_keys,
                 std::unique_ptr<Value> key,
                 std::unique_ptr<Value> value,
                 float hash_factor,
-                int update_count_to_auto_compact
+                float compact_garbage_ratio,
+                uint64_t compact_min_garbage
        );
+        KV(std::unique_ptr<Meta> meta, std::vector<std::unique_ptr<KV>> shards);
     };
 }
 
@@ -0,0 +1,84 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#include "ValueStream.h"
+
+#include <algorithm>
+#include <cstring>
+#include "KV.h"
+
+namespace EmoKV {
+    ValueReader::ValueReader(KV* kv, uint64_t pos, uint64_t len): kv_(kv), pos_(pos), len_(len) {
+    }
+
+    ValueReader::~ValueReader() {
+        kv_->close_stream(INDEX_NO_POS, 0);
+    }
+
+    uint64_t ValueReader::len() const {
+        return len_;
+    }
+
+    size_t ValueReader::Read(uint64_t offset, size_t max, const ValueSink& sink) {
+        if(offset >= len_){
+            return 0;
+        }
+        auto len = static_cast<size_t>(std::min<uint64_t>(max, len_ - offset));
+        if(pos_ == INDEX_NO_POS){
+            sink(inline_ + offset, len);
+            return len;
+        }
+        // the storage may have been mapped again since the stream opened, it's still the same file.
+        EpochGuard guard(kv_->epoch_);
+        sink(kv_->generation_.load()->value->view(pos_ + offset), len);
+        return len;
+    }
+
+    ValueWriter::ValueWriter(KV* kv, Buf* key, uint64_t pos, uint64_t len):
+    kv_(kv),
+    key_(reinterpret_cast<const char*>(key->ptr()), key->len()),
+    pos_(pos),
+    len_(len) {
+    }
+
+    ValueWriter::~ValueWriter() {
+        // a value kept in the item leaves its space unused as well.
+        bool unused = !committed_ || len_ <= sizeof(uint64_t);
+        kv_->close_stream(unused && len_ > 0 ? pos_ : INDEX_NO_POS, len_);
+    }
+
+    uint64_t ValueWriter::len() const {
+        return len_;
+    }
+
+    uint64_t ValueWriter::written() const {
+        return written_;
+    }
+
+    bool ValueWriter::Write(size_t len, const ValueSource& source) {
+        if(committed_ || len > len_ - written_){
+            return false;
+        }
+        // the storage reaches the end of the value since the writer was made.
+        EpochGuard guard(kv_->epoch_);
+        source(kv_->generation_.load()->value->mutable_view(pos_ + written_), len);
+        written_ += len;
+        return true;
+    }
+
+    bool ValueWriter::Write(const uint8_t* data, size_t len) {
+        return Write(len, [data](uint8_t* dst, size_t n) {
+            memcpy(dst, data, n);
+        });
+    }
+
+    bool ValueWriter::Commit() {
+        if(committed_ || written_ != len_){
+            return false;
+        }
+        Buf key(reinterpret_cast<const uint8_t*>(key_.data()), key_.size(), false);
+        committed_ = kv_->commit_value(&key, pos_, len_);
+        return committed_;
+    }
+}
@@ -0,0 +1,70 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#ifndef EMO_VALUE_STREAM_H
+#define EMO_VALUE_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "data/Index.h"
+
+namespace EmoKV {
+    class KV;
+
+    // fills the len bytes at dst, which is in the mapping of the value storage. only valid during the call.
+    typedef std::function<void(uint8_t* dst, size_t len)> ValueSource;
+
+    // Streams let a value be read or written a chunk at a time straight from or into the mapping, so
+    // that a long one is never copied as a whole. While one is open the KV keeps the bytes it reads in
+    // place: compaction waits for the last stream to close, the extents freed meanwhile are not reused
+    // and no value is written over the one it replaces. A stream must be deleted before its KV.
+
+    // Reads the value a key had when it opened, made by KV::NewValueReader. Writes of the key meanwhile
+    // don't change what it reads.
+    class ValueReader {
+    public:
+        friend class KV;
+        ~ValueReader();
+        uint64_t len() const;
+        // gives up to max bytes from offset to sink, the bytes are only valid in the call. the count of
+        // them, 0 from the end on.
+        size_t Read(uint64_t offset, size_t max, const ValueSink& sink);
+
+    private:
+        ValueReader(KV* kv, uint64_t pos, uint64_t len);
+        KV* kv_;
+        // INDEX_NO_POS for a value kept in the item, copied in inline_.
+        uint64_t pos_;
+        uint64_t len_;
+        uint8_t inline_[sizeof(uint64_t)];
+    };
+
+    // Writes a value whose length is known ahead into space placed for it, made by KV::NewValueWriter.
+    // The key gets it on Commit, a writer deleted before leaves the key as it was.
+    class ValueWriter {
+    public:
+        friend class KV;
+        ~ValueWriter();
+        uint64_t len() const;
+        uint64_t written() const;
+        // has source fill the next len bytes of the value. false past its length, or once committed.
+        bool Write(size_t len, const ValueSource& source);
+        bool Write(const uint8_t* data, size_t len);
+        // writes the item of the key once all the bytes are written, see KV::Put.
+        bool Commit();
+
+    private:
+        ValueWriter(KV* kv, Buf* key, uint64_t pos, uint64_t len);
+        KV* kv_;
+        std::string key_;
+        uint64_t pos_;
+        uint64_t len_;
+        uint64_t written_ = 0;
+        bool committed_ = false;
+    };
+}
+
+#endif //EMO_VALUE_STREAM_H
@@ -0,0 +1,72 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#include "WriteBatch.h"
+
+namespace EmoKV {
+    static uint32_t read_le(const uint8_t* data, size_t len){
+        uint32_t value = 0;
+        for(size_t i = len; i > 0; i--){
+            value = (value << 8) | data[i - 1];
+        }
+        return value;
+    }
+
+    bool WriteBatch::parse(const uint8_t* data, size_t len) {
+        size_t pos = 0;
+        while (pos < len){
+            uint8_t op = data[pos++];
+            if((op != WRITE_BATCH_OP_PUT && op != WRITE_BATCH_OP_DEL) || len - pos < sizeof(uint16_t)){
+                return false;
+            }
+            size_t key_len = read_le(data + pos, sizeof(uint16_t));
+            pos += sizeof(uint16_t);
+            if(len - pos < key_len){
+                return false;
+            }
+            const uint8_t* key = data + pos;
+            pos += key_len;
+            if(op == WRITE_BATCH_OP_DEL){
+                del(key, key_len);
+                continue;
+            }
+            if(len - pos < sizeof(uint32_t)){
+                return false;
+            }
+            size_t value_len = read_le(data + pos, sizeof(uint32_t));
+            pos += sizeof(uint32_t);
+            if(len - pos < value_len){
+                return false;
+            }
+            put(key, key_len, data + pos, value_len);
+            pos += value_len;
+        }
+        return true;
+    }
+
+    void WriteBatch::put(const uint8_t* key, size_t key_len, const uint8_t* value, size_t value_len) {
+        Op op;
+        op.key.reset(new Buf(key, key_len, false));
+        op.value.reset(new Buf(value, value_len, false));
+        ops_.push_back(std::move(op));
+    }
+
+    void WriteBatch::del(const uint8_t* key, size_t key_len) {
+        Op op;
+        op.key.reset(new Buf(key, key_len, false));
+        ops_.push_back(std::move(op));
+    }
+
+    void WriteBatch::add(Op op) {
+        ops_.push_back(std::move(op));
+    }
+
+    std::vector<WriteBatch::Op>& WriteBatch::ops() {
+        return ops_;
+    }
+
+    bool WriteBatch::empty() const {
+        return ops_.empty();
+    }
+}
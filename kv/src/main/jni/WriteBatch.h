@@ -0,0 +1,43 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#ifndef EMO_WRITE_BATCH_H
+#define EMO_WRITE_BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Buf.h"
+
+#define WRITE_BATCH_OP_PUT 1
+#define WRITE_BATCH_OP_DEL 2
+
+namespace EmoKV {
+
+    // Puts and deletes that KV::Write applies as a whole, in order.
+    // Serialized form, as EmoKV.WriteBatch writes it, integers little endian:
+    // op(1):key_len(2):key[:value_len(4):value], op is WRITE_BATCH_OP_PUT or WRITE_BATCH_OP_DEL.
+    class WriteBatch {
+    public:
+        struct Op {
+            std::unique_ptr<Buf> key;
+            // null for a delete.
+            std::unique_ptr<Buf> value;
+        };
+        // the ops point into data, which must outlive the batch. false when it's malformed.
+        bool parse(const uint8_t* data, size_t len);
+        // the bytes are not copied either.
+        void put(const uint8_t* key, size_t key_len, const uint8_t* value, size_t value_len);
+        void del(const uint8_t* key, size_t key_len);
+        void add(Op op);
+        std::vector<Op>& ops();
+        bool empty() const;
+
+    private:
+        std::vector<Op> ops_;
+    };
+}
+
+#endif //EMO_WRITE_BATCH_H
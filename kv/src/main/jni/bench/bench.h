@@ -0,0 +1,131 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#ifndef EMO_BENCH_H
+#define EMO_BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include "Buf.h"
+
+namespace EmoKV {
+    namespace bench {
+
+        inline uint64_t now_ns(){
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        // Anonymous mapping, so that Value/Index can munmap it like a file mapping.
+        inline void* anon_map(size_t size){
+            void* start = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            return start == MAP_FAILED ? nullptr : start;
+        }
+
+        // Keys shaped like ours: a shared namespace prefix and a numeric suffix.
+        inline std::vector<std::string> make_keys(size_t count, const std::string& prefix, size_t seed){
+            std::vector<std::string> keys;
+            keys.reserve(count);
+            for(size_t i = 0; i < count; i++){
+                keys.push_back(prefix + std::to_string(seed + i));
+            }
+            return keys;
+        }
+
+        inline std::vector<std::unique_ptr<Buf>> make_bufs(const std::vector<std::string>& keys){
+            std::vector<std::unique_ptr<Buf>> bufs;
+            bufs.reserve(keys.size());
+            for(const auto& key : keys){
+                bufs.emplace_back(new Buf(reinterpret_cast<const uint8_t *>(key.data()), key.size(), false));
+            }
+            return bufs;
+        }
+
+        template<typename T>
+        inline void shuffle(std::vector<T>& items, uint32_t seed){
+            std::mt19937 rng(seed);
+            std::shuffle(items.begin(), items.end(), rng);
+        }
+
+        inline uint64_t percentile(std::vector<uint64_t>& sorted, double p){
+            if(sorted.empty()){
+                return 0;
+            }
+            auto i = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+            return sorted[i];
+        }
+
+        struct Options {
+            std::string filter;
+            int reps = 5;
+            bool quick = false;
+        };
+
+        inline Options parse_options(int argc, char** argv){
+            Options options;
+            for(int i = 1; i < argc; i++){
+                std::string arg(argv[i]);
+                if(arg == "--quick"){
+                    options.quick = true;
+                    options.reps = 2;
+                }else if(arg == "--reps" && i + 1 < argc){
+                    options.reps = std::max(1, atoi(argv[++i]));
+                }else{
+                    options.filter = arg;
+                }
+            }
+            return options;
+        }
+
+        // Runs setup() + body() `reps` times and reports the median ns per op of body().
+        // body() returns the number of operations it did.
+        class Runner {
+        public:
+            explicit Runner(const Options& options): options_(options){
+                printf("%-28s %-36s %12s %12s %10s\n", "benchmark", "params", "median ns/op", "min ns/op", "ops");
+            }
+
+            bool enabled(const std::string& name) const {
+                return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+            }
+
+            void run(
+                    const std::string& name,
+                    const std::string& params,
+                    const std::function<void()>& setup,
+                    const std::function<size_t()>& body
+            ){
+                if(!enabled(name)){
+                    return;
+                }
+                std::vector<double> samples;
+                size_t ops = 0;
+                for(int i = 0; i < options_.reps; i++){
+                    setup();
+                    auto start = now_ns();
+                    ops = body();
+                    auto end = now_ns();
+                    samples.push_back(ops == 0 ? 0 : static_cast<double>(end - start) / static_cast<double>(ops));
+                }
+                std::sort(samples.begin(), samples.end());
+                printf("%-28s %-36s %12.1f %12.1f %10zu\n",
+                       name.c_str(), params.c_str(), samples[samples.size() / 2], samples[0], ops);
+                fflush(stdout);
+            }
+
+        private:
+            Options options_;
+        };
+    }
+}
+
+#endif //EMO_BENCH_H
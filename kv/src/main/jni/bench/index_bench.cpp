@@ -0,0 +1,239 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+// Per-component microbenchmarks of the KV core, without JNI or device noise:
+//   EmoKVIndexBench [--quick] [--reps n] [name filter]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include "bench.h"
+#include "data/Index.h"
+#include "data/Value.h"
+
+using namespace EmoKV;
+using namespace EmoKV::bench;
+
+namespace {
+    const size_t VALUE_LEN = 32;
+
+    struct Table {
+        std::unique_ptr<Index> index;
+        std::unique_ptr<Value> key;
+        std::unique_ptr<Value> value;
+    };
+
+    Index* make_index(uint32_t capability){
+        size_t size = Index::size_for(capability);
+        return new Index(calloc(1, size), size, IndexMode::MEMORY);
+    }
+
+    Value* make_value(size_t size){
+        return new Value(anon_map(size), size);
+    }
+
+    Table make_table(uint32_t capability, size_t key_space, size_t value_space){
+        Table table;
+        table.index.reset(make_index(capability));
+        table.key.reset(make_value(key_space));
+        table.value.reset(make_value(value_space));
+        return table;
+    }
+
+    void fill(Table& table, std::vector<std::unique_ptr<Buf>>& keys, Buf* value){
+        for(auto& key : keys){
+            if(table.index->write(table.key.get(), table.value.get(), key.get(), value) != 0){
+                fprintf(stderr, "fill: storage is full\n");
+                exit(1);
+            }
+        }
+    }
+
+    std::string table_params(uint32_t capability, double load){
+        char buf[64];
+        snprintf(buf, sizeof(buf), "cap=%u load=%.2f", capability, load);
+        return buf;
+    }
+
+    void bench_hash(Runner& runner, const Options& options){
+        const size_t count = options.quick ? 10000 : 100000;
+        const size_t lens[] = {8, 16, 32, 64};
+        for(auto len : lens){
+            std::vector<std::string> keys;
+            for(size_t i = 0; i < count; i++){
+                std::string key = "config_" + std::to_string(i);
+                key.resize(len, '_');
+                keys.push_back(key);
+            }
+            auto bufs = make_bufs(keys);
+            volatile uint64_t sink = 0;
+            runner.run("buf.hash", "key_len=" + std::to_string(len), [](){}, [&]() {
+                uint64_t h = 0;
+                for(auto& buf : bufs){
+                    h ^= buf->hash(0x9E3779B97F4A7C15ull);
+                }
+                sink = h;
+                return bufs.size();
+            });
+        }
+    }
+
+    void bench_index(Runner& runner, const Options& options){
+        std::vector<uint32_t> capabilities = {1u << 10, 1u << 14};
+        if(!options.quick){
+            capabilities.push_back(1u << 17);
+        }
+        const double loads[] = {0.5, 0.75, 0.9};
+        std::string value_data(VALUE_LEN, 'v');
+        Buf value(reinterpret_cast<const uint8_t *>(value_data.data()), value_data.size(), false);
+
+        for(auto capability : capabilities){
+            for(auto load : loads){
+                auto count = static_cast<size_t>(capability * load);
+                auto keys = make_keys(count, "config_item_", 0);
+                auto misses = make_keys(count, "config_miss_", 0);
+                auto key_bufs = make_bufs(keys);
+                auto miss_bufs = make_bufs(misses);
+                size_t key_space = count * 32 + 4096;
+                size_t value_space = count * VALUE_LEN * 4 + 4096;
+                auto params = table_params(capability, load);
+
+                Table table;
+                runner.run("index.write.insert", params, [&]() {
+                    table = make_table(capability, key_space, value_space);
+                }, [&]() {
+                    fill(table, key_bufs, &value);
+                    return count;
+                });
+
+                runner.run("index.write.update", params, [&]() {
+                    table = make_table(capability, key_space, value_space);
+                    fill(table, key_bufs, &value);
+                    shuffle(key_bufs, 7);
+                }, [&]() {
+                    fill(table, key_bufs, &value);
+                    return count;
+                });
+
+                table = make_table(capability, key_space, value_space);
+                fill(table, key_bufs, &value);
+                shuffle(key_bufs, 11);
+
+                uint8_t out[VALUE_LEN];
+                ValueSink copy_out = [&out](const uint8_t* data, size_t len) {
+                    memcpy(out, data, len);
+                };
+                runner.run("index.read.hit", params, [](){}, [&]() {
+                    for(auto& key : key_bufs){
+                        if(!table.index->read(table.key.get(), table.value.get(), key.get(), copy_out)){
+                            fprintf(stderr, "index.read.hit: missing key\n");
+                            exit(1);
+                        }
+                    }
+                    return count;
+                });
+
+                std::vector<Buf*> key_ptrs;
+                for(auto& key : key_bufs){
+                    key_ptrs.push_back(key.get());
+                }
+                std::vector<uint8_t> found;
+                MultiValueSink multi_copy_out = [&out](size_t, const uint8_t* data, size_t len) {
+                    memcpy(out, data, len);
+                };
+                runner.run("index.read.multi", params, [](){}, [&]() {
+                    found.assign(count, 0);
+                    table.index->read_multi(table.key.get(), table.value.get(), key_ptrs.data(), count, found, multi_copy_out);
+                    if(std::find(found.begin(), found.end(), 0) != found.end()){
+                        fprintf(stderr, "index.read.multi: missing key\n");
+                        exit(1);
+                    }
+                    return count;
+                });
+
+                runner.run("index.read.hit.buf", params, [](){}, [&]() {
+                    for(auto& key : key_bufs){
+                        if(table.index->read(table.key.get(), table.value.get(), key.get()) == nullptr){
+                            fprintf(stderr, "index.read.hit.buf: missing key\n");
+                            exit(1);
+                        }
+                    }
+                    return count;
+                });
+
+                runner.run("index.read.miss", params, [](){}, [&]() {
+                    for(auto& key : miss_bufs){
+                        if(table.index->read(table.key.get(), table.value.get(), key.get(), copy_out)){
+                            fprintf(stderr, "index.read.miss: unexpected hit\n");
+                            exit(1);
+                        }
+                    }
+                    return count;
+                });
+
+                std::unique_ptr<Index> target;
+                runner.run("index.copy_from", params, [&]() {
+                    target.reset(make_index(capability * 2));
+                }, [&]() {
+                    target->copy_from(table.key.get(), table.index.get());
+                    return count;
+                });
+
+                std::unique_ptr<Value> compacted;
+                runner.run("index.compact", params, [&]() {
+                    target.reset(make_index(capability));
+                    target->copy_from(table.key.get(), table.index.get());
+                    compacted.reset(make_value(value_space));
+                }, [&]() {
+                    target->compact(table.value.get(), compacted.get());
+                    return count;
+                });
+            }
+        }
+    }
+
+    void bench_value(Runner& runner, const Options& options){
+        const size_t count = options.quick ? 10000 : 100000;
+        const size_t lens[] = {16, 128, 1024};
+        for(auto len : lens){
+            size_t size = count * len;
+            std::unique_ptr<Value> value(make_value(size));
+            std::vector<uint64_t> offsets;
+            for(size_t i = 0; i < count; i++){
+                offsets.push_back(i * len);
+            }
+            shuffle(offsets, 13);
+            runner.run("value.get", "len=" + std::to_string(len), [](){}, [&]() {
+                for(auto offset : offsets){
+                    auto ret = value->get(offset, len);
+                    if(ret->len() != len){
+                        exit(1);
+                    }
+                }
+                return count;
+            });
+
+            std::string data(len, 'k');
+            value->put(0, reinterpret_cast<const uint8_t *>(data.data()), len);
+            Buf probe(reinterpret_cast<const uint8_t *>(data.data()), len, false);
+            runner.run("value.equal", "len=" + std::to_string(len), [](){}, [&]() {
+                for(size_t i = 0; i < count; i++){
+                    if(!value->equal(0, len, &probe)){
+                        exit(1);
+                    }
+                }
+                return count;
+            });
+        }
+    }
+}
+
+int main(int argc, char** argv){
+    auto options = parse_options(argc, argv);
+    Runner runner(options);
+    bench_hash(runner, options);
+    bench_index(runner, options);
+    bench_value(runner, options);
+    return 0;
+}
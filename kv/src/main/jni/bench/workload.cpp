@@ -0,0 +1,499 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+// YCSB style macro workloads against KV, reporting throughput and latency percentiles
+// per operation, and separately for the operations that overlapped expand_index,
+// expand_value or a compaction pass:
+//   EmoKVWorkload [--workload a|b|c|d|f|all] [--dist uniform|zipfian|latest] [--threads n]
+//                 [--records n] [--ops n] [--value-size n] [--delete ratio]
+//                 [--index-space n] [--key-space n] [--value-space n] [--compact-ratio r]
+//                 [--compact-min n] [--shards n] [--load-batch n] [--dir path]
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "bench.h"
+#include "KV.h"
+
+using namespace EmoKV;
+using namespace EmoKV::bench;
+
+namespace {
+    enum Op {
+        OP_READ = 0,
+        OP_UPDATE,
+        OP_INSERT,
+        OP_DELETE,
+        OP_RMW,
+        OP_COUNT
+    };
+
+    const char* OP_NAMES[OP_COUNT] = {"read", "update", "insert", "delete", "rmw"};
+    const char* MAINTAIN_NAMES[MAINTAIN_KIND_COUNT] = {"expand_index", "expand_key", "expand_value", "compact"};
+
+    enum Dist {
+        DIST_UNIFORM,
+        DIST_ZIPFIAN,
+        DIST_LATEST
+    };
+
+    struct Workload {
+        char name;
+        const char* desc;
+        double read;
+        double update;
+        double insert;
+        double rmw;
+        Dist dist;
+    };
+
+    const Workload WORKLOADS[] = {
+            {'a', "update heavy", 0.5, 0.5, 0, 0, DIST_ZIPFIAN},
+            {'b', "read heavy", 0.95, 0.05, 0, 0, DIST_ZIPFIAN},
+            {'c', "read only", 1, 0, 0, 0, DIST_ZIPFIAN},
+            {'d', "read latest", 0.95, 0, 0.05, 0, DIST_LATEST},
+            {'f', "read-modify-write", 0.5, 0, 0, 0.5, DIST_ZIPFIAN},
+    };
+
+    struct Config {
+        std::string workloads = "all";
+        std::string dist;
+        int threads = 4;
+        // the inserts of workload d take the index past its load factor once, so that the rows of the
+        // operations during maintenance aren't empty by default.
+        uint64_t records = 180000;
+        uint64_t ops = 400000;
+        size_t value_size = 100;
+        double del = 0;
+        size_t index_space = 17024;
+        size_t key_space = 4096;
+        size_t value_space = 1024 * 1024;
+        float compact_ratio = 0.5f;
+        uint64_t compact_min = 1024 * 1024;
+        uint32_t shards = 1;
+        // records loaded by each KV::Write, 1 loads them with Put.
+        int load_batch = 1;
+        std::string dir = "/tmp/emokv-workload";
+    };
+
+    uint64_t fnv_hash64(uint64_t val){
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for(int i = 0; i < 8; i++){
+            hash ^= val & 0xff;
+            hash *= 1099511628211ull;
+            val >>= 8;
+        }
+        return hash;
+    }
+
+    // Zipfian over [0, items), as in YCSB (Gray et al, "Quickly Generating Billion-Record Synthetic Databases").
+    // items may only grow, zeta is then extended incrementally.
+    class Zipfian {
+    public:
+        explicit Zipfian(uint64_t items, double theta = 0.99): items_(0), theta_(theta), zetan_(0){
+            zeta2_ = zeta(0, 2, 0);
+            alpha_ = 1.0 / (1.0 - theta_);
+            grow(items);
+        }
+
+        void grow(uint64_t items){
+            if(items <= items_){
+                return;
+            }
+            zetan_ = zeta(items_, items, zetan_);
+            items_ = items;
+            eta_ = (1 - std::pow(2.0 / static_cast<double>(items_), 1 - theta_)) / (1 - zeta2_ / zetan_);
+        }
+
+        uint64_t items() const {
+            return items_;
+        }
+
+        uint64_t next(std::mt19937_64& rng){
+            double u = std::uniform_real_distribution<double>(0, 1)(rng);
+            double uz = u * zetan_;
+            if(uz < 1.0){
+                return 0;
+            }
+            if(uz < 1.0 + std::pow(0.5, theta_)){
+                return 1;
+            }
+            auto ret = static_cast<uint64_t>(
+                    static_cast<double>(items_) * std::pow(eta_ * u - eta_ + 1, alpha_));
+            return ret >= items_ ? items_ - 1 : ret;
+        }
+
+    private:
+        uint64_t items_;
+        double theta_;
+        double zeta2_;
+        double zetan_;
+        double alpha_;
+        double eta_;
+
+        double zeta(uint64_t from, uint64_t to, double initial) const {
+            double sum = initial;
+            for(uint64_t i = from; i < to; i++){
+                sum += 1 / std::pow(static_cast<double>(i + 1), theta_);
+            }
+            return sum;
+        }
+    };
+
+    // Shared by all threads of a run.
+    struct State {
+        const Workload* workload;
+        Dist dist;
+        // key numbers handed out to inserts, and the count of the first ones that are all written: the
+        // keys below it are the ones a read may pick.
+        std::atomic<uint64_t> next_insert;
+        std::atomic<uint64_t> inserted;
+        Zipfian zipfian;
+        std::mutex zipfian_lock;
+        State(const Workload* workload, Dist dist, uint64_t records):
+                workload(workload), dist(dist), next_insert(records), inserted(records), zipfian(records){}
+    };
+
+    struct Samples {
+        // latency in ns, indexed by op; then by the maintenance kind the op overlapped.
+        std::vector<uint64_t> all[OP_COUNT];
+        std::vector<uint64_t> during[MAINTAIN_KIND_COUNT][OP_COUNT];
+        uint64_t not_found = 0;
+    };
+
+    std::string make_key(uint64_t n){
+        // scramble the key number so that hot keys are spread over the key space, like YCSB's hashed inserts.
+        return "user" + std::to_string(fnv_hash64(n));
+    }
+
+    std::string make_value(uint64_t n, size_t size){
+        std::string value = std::to_string(n) + ":";
+        value.resize(size, 'x');
+        return value;
+    }
+
+    std::unique_ptr<Buf> buf_of(const std::string& s){
+        return std::unique_ptr<Buf>(new Buf(reinterpret_cast<const uint8_t *>(s.data()), s.size(), false));
+    }
+
+    uint64_t next_key(State& state, std::mt19937_64& rng){
+        uint64_t count = state.inserted.load();
+        switch (state.dist){
+            case DIST_UNIFORM:
+                return std::uniform_int_distribution<uint64_t>(0, count - 1)(rng);
+            case DIST_ZIPFIAN: {
+                // scrambled zipfian: popularity is skewed, popular items are not clustered.
+                std::lock_guard<std::mutex> lock(state.zipfian_lock);
+                return fnv_hash64(state.zipfian.next(rng)) % state.zipfian.items();
+            }
+            case DIST_LATEST: {
+                std::lock_guard<std::mutex> lock(state.zipfian_lock);
+                state.zipfian.grow(count);
+                auto n = state.zipfian.next(rng);
+                return count - 1 - (n < count ? n : count - 1);
+            }
+        }
+        return 0;
+    }
+
+    void run_thread(KV* kv, State& state, const Config& config, uint64_t ops, uint32_t seed, Samples& samples){
+        std::mt19937_64 rng(seed);
+        std::uniform_real_distribution<double> chooser(0, 1);
+        const Workload* w = state.workload;
+        uint32_t before[MAINTAIN_KIND_COUNT];
+        for(uint64_t i = 0; i < ops; i++){
+            double r = chooser(rng);
+            Op op;
+            if(config.del > 0 && chooser(rng) < config.del){
+                op = OP_DELETE;
+            }else if(r < w->read){
+                op = OP_READ;
+            }else if(r < w->read + w->update){
+                op = OP_UPDATE;
+            }else if(r < w->read + w->update + w->insert){
+                op = OP_INSERT;
+            }else{
+                op = OP_RMW;
+            }
+
+            uint64_t n = op == OP_INSERT ? state.next_insert.fetch_add(1) : next_key(state, rng);
+            std::string key = make_key(n);
+            std::string value = make_value(n, config.value_size);
+
+            for(int k = 0; k < MAINTAIN_KIND_COUNT; k++){
+                before[k] = kv->MaintainSeq(k);
+            }
+            auto start = now_ns();
+            switch (op){
+                case OP_READ:
+                    if(kv->Get(buf_of(key)) == nullptr){
+                        samples.not_found++;
+                    }
+                    break;
+                case OP_UPDATE:
+                    kv->Put(buf_of(key), buf_of(value));
+                    break;
+                case OP_INSERT:
+                    kv->Put(buf_of(key), buf_of(value));
+                    break;
+                case OP_DELETE:
+                    kv->Del(buf_of(key));
+                    break;
+                case OP_RMW: {
+                    auto old = kv->Get(buf_of(key));
+                    if(old == nullptr){
+                        samples.not_found++;
+                    }
+                    kv->Put(buf_of(key), buf_of(value));
+                    break;
+                }
+                default:
+                    break;
+            }
+            auto latency = now_ns() - start;
+            if(op == OP_INSERT){
+                // published in key order once written, after the inserts of the keys before it.
+                while (state.inserted.load() != n){
+                    std::this_thread::yield();
+                }
+                state.inserted.store(n + 1);
+            }
+            samples.all[op].push_back(latency);
+            for(int k = 0; k < MAINTAIN_KIND_COUNT; k++){
+                auto after = kv->MaintainSeq(k);
+                if((before[k] & 1) == 1 || after != before[k]){
+                    samples.during[k][op].push_back(latency);
+                }
+            }
+        }
+    }
+
+    void print_row(const std::string& name, std::vector<uint64_t>& latencies){
+        if(latencies.empty()){
+            return;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        double sum = 0;
+        for(auto l : latencies){
+            sum += static_cast<double>(l);
+        }
+        printf("  %-26s %10zu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               name.c_str(),
+               latencies.size(),
+               sum / static_cast<double>(latencies.size()) / 1000,
+               static_cast<double>(percentile(latencies, 0.5)) / 1000,
+               static_cast<double>(percentile(latencies, 0.99)) / 1000,
+               static_cast<double>(percentile(latencies, 0.999)) / 1000,
+               static_cast<double>(latencies.back()) / 1000);
+    }
+
+    Dist parse_dist(const std::string& s, Dist fallback){
+        if(s == "uniform"){
+            return DIST_UNIFORM;
+        }
+        if(s == "zipfian"){
+            return DIST_ZIPFIAN;
+        }
+        if(s == "latest"){
+            return DIST_LATEST;
+        }
+        return fallback;
+    }
+
+    const char* dist_name(Dist dist){
+        switch (dist){
+            case DIST_UNIFORM:
+                return "uniform";
+            case DIST_ZIPFIAN:
+                return "zipfian";
+            case DIST_LATEST:
+                return "latest";
+        }
+        return "";
+    }
+
+    void remove_dir(const std::string& dir){
+        std::string cmd = "rm -rf '" + dir + "'";
+        if(system(cmd.c_str()) != 0){
+            fprintf(stderr, "failed to remove %s\n", dir.c_str());
+        }
+    }
+
+    KV* open_kv(const Config& config, std::string& dir){
+        remove_dir(dir);
+        mkdir(dir.c_str(), S_IRWXU);
+        return KV::make(
+                dir,
+                config.index_space,
+                config.key_space,
+                config.value_space,
+                0.75f,
+                config.compact_ratio,
+                config.compact_min,
+                config.shards
+        );
+    }
+
+    void load(KV* kv, const Config& config){
+        std::vector<std::thread> threads;
+        auto per_thread = config.records / config.threads;
+        for(int t = 0; t < config.threads; t++){
+            uint64_t from = t * per_thread;
+            uint64_t to = t == config.threads - 1 ? config.records : from + per_thread;
+            threads.emplace_back([kv, from, to, &config]() {
+                if(config.load_batch <= 1){
+                    for(uint64_t n = from; n < to; n++){
+                        kv->Put(buf_of(make_key(n)), buf_of(make_value(n, config.value_size)));
+                    }
+                    return;
+                }
+                std::vector<std::string> keys;
+                std::vector<std::string> values;
+                for(uint64_t n = from; n < to; n += config.load_batch){
+                    uint64_t end = std::min<uint64_t>(to, n + config.load_batch);
+                    keys.clear();
+                    values.clear();
+                    WriteBatch batch;
+                    for(uint64_t i = n; i < end; i++){
+                        keys.push_back(make_key(i));
+                        values.push_back(make_value(i, config.value_size));
+                    }
+                    for(size_t i = 0; i < keys.size(); i++){
+                        batch.put(reinterpret_cast<const uint8_t *>(keys[i].data()), keys[i].size(),
+                                  reinterpret_cast<const uint8_t *>(values[i].data()), values[i].size());
+                    }
+                    kv->Write(batch);
+                }
+            });
+        }
+        for(auto& thread : threads){
+            thread.join();
+        }
+    }
+
+    void run_workload(const Workload& w, const Config& config){
+        std::string dir = config.dir;
+        std::unique_ptr<KV> kv(open_kv(config, dir));
+        if(kv == nullptr){
+            fprintf(stderr, "failed to open kv in %s\n", dir.c_str());
+            exit(1);
+        }
+        auto load_start = now_ns();
+        load(kv.get(), config);
+        auto load_ns = now_ns() - load_start;
+
+        State state(&w, parse_dist(config.dist, w.dist), config.records);
+        std::vector<Samples> samples(config.threads);
+        std::vector<std::thread> threads;
+        auto per_thread = config.ops / config.threads;
+        auto start = now_ns();
+        for(int t = 0; t < config.threads; t++){
+            threads.emplace_back([&, t]() {
+                run_thread(kv.get(), state, config, per_thread, 1000 + t, samples[t]);
+            });
+        }
+        for(auto& thread : threads){
+            thread.join();
+        }
+        auto elapsed = now_ns() - start;
+
+        printf("\nworkload %c (%s), dist=%s, threads=%d, shards=%u, load batch=%d, records=%llu, ops=%llu, value=%zu, delete=%.2f\n",
+               w.name, w.desc, dist_name(state.dist), config.threads, config.shards, config.load_batch,
+               static_cast<unsigned long long>(config.records),
+               static_cast<unsigned long long>(per_thread * config.threads),
+               config.value_size, config.del);
+        printf("  load: %.1f ops/s, run: %.1f ops/s\n",
+               static_cast<double>(config.records) * 1e9 / static_cast<double>(load_ns),
+               static_cast<double>(per_thread * config.threads) * 1e9 / static_cast<double>(elapsed));
+        printf("  %-26s %10s %10s %10s %10s %10s %10s\n", "op (us)", "count", "avg", "p50", "p99", "p999", "max");
+
+        uint64_t not_found = 0;
+        for(auto& s : samples){
+            not_found += s.not_found;
+        }
+        for(int op = 0; op < OP_COUNT; op++){
+            std::vector<uint64_t> merged;
+            for(auto& s : samples){
+                merged.insert(merged.end(), s.all[op].begin(), s.all[op].end());
+            }
+            print_row(OP_NAMES[op], merged);
+        }
+        for(int k = 0; k < MAINTAIN_KIND_COUNT; k++){
+            printf("  during %s (%u passes, load included):\n", MAINTAIN_NAMES[k], kv->MaintainSeq(k) / 2);
+            for(int op = 0; op < OP_COUNT; op++){
+                std::vector<uint64_t> merged;
+                for(auto& s : samples){
+                    merged.insert(merged.end(), s.during[k][op].begin(), s.during[k][op].end());
+                }
+                print_row(std::string("  ") + OP_NAMES[op], merged);
+            }
+        }
+        if(not_found > 0){
+            printf("  not found: %llu\n", static_cast<unsigned long long>(not_found));
+        }
+        fflush(stdout);
+        kv.reset();
+        remove_dir(dir);
+    }
+
+    Config parse_config(int argc, char** argv){
+        Config config;
+        for(int i = 1; i + 1 < argc; i += 2){
+            std::string arg(argv[i]);
+            std::string value(argv[i + 1]);
+            if(arg == "--workload"){
+                config.workloads = value;
+            }else if(arg == "--dist"){
+                config.dist = value;
+            }else if(arg == "--threads"){
+                config.threads = std::max(1, atoi(value.c_str()));
+            }else if(arg == "--records"){
+                config.records = std::max(1ull, strtoull(value.c_str(), nullptr, 10));
+            }else if(arg == "--ops"){
+                config.ops = strtoull(value.c_str(), nullptr, 10);
+            }else if(arg == "--value-size"){
+                config.value_size = std::min<size_t>(65535, strtoull(value.c_str(), nullptr, 10));
+            }else if(arg == "--delete"){
+                config.del = atof(value.c_str());
+            }else if(arg == "--index-space"){
+                config.index_space = strtoull(value.c_str(), nullptr, 10);
+            }else if(arg == "--key-space"){
+                config.key_space = strtoull(value.c_str(), nullptr, 10);
+            }else if(arg == "--value-space"){
+                config.value_space = strtoull(value.c_str(), nullptr, 10);
+            }else if(arg == "--compact-ratio"){
+                config.compact_ratio = static_cast<float>(atof(value.c_str()));
+            }else if(arg == "--compact-min"){
+                config.compact_min = strtoull(value.c_str(), nullptr, 10);
+            }else if(arg == "--shards"){
+                config.shards = static_cast<uint32_t>(std::max(1, atoi(value.c_str())));
+            }else if(arg == "--load-batch"){
+                config.load_batch = std::max(1, atoi(value.c_str()));
+            }else if(arg == "--dir"){
+                config.dir = value;
+            }else{
+                fprintf(stderr, "unknown option %s\n", arg.c_str());
+                exit(1);
+            }
+        }
+        return config;
+    }
+}
+
+int main(int argc, char** argv){
+    auto config = parse_config(argc, argv);
+    for(const auto& w : WORKLOADS){
+        if(config.workloads == "all" || config.workloads.find(w.name) != std::string::npos){
+            run_workload(w, config);
+        }
+    }
+    return 0;
+}
@@ -7,8 +7,14 @@
 #include "util/log.h"
 #include "KV.h"
 #include "Buf.h"
+#include "WriteBatch.h"
 #include "atomic"
+#include <algorithm>
+#include <cstring>
 #include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
 using namespace EmoKV;
 
@@ -38,7 +44,9 @@ static jlong initKV(
         jlong key_init_space,
         jlong value_init_space,
         jfloat hash_factor,
-        jint update_count_to_auto_compact
+        jfloat compact_garbage_ratio,
+        jlong compact_min_garbage,
+        jint shard_count
 ){
     auto kv_dir = jstringToString(env, dir);
     KV* kv = KV::make(
@@ -47,30 +55,186 @@ static jlong initKV(
             key_init_space,
             value_init_space,
             hash_factor,
-            update_count_to_auto_compact
+            compact_garbage_ratio,
+            (uint64_t) std::max<jlong>(compact_min_garbage, 0),
+            (uint32_t) std::max(shard_count, 1)
     );
     return (jlong) kv;
 }
 
+static const jsize KEY_STACK_LEN = 256;
+
+// copies the key out of the java array, keys are short and stay on the stack.
+class JKey {
+public:
+    JKey(JNIEnv *env, jbyteArray array) {
+        jsize len = env->GetArrayLength(array);
+        jbyte* data = stack_;
+        if(len > KEY_STACK_LEN){
+            heap_.reset(new jbyte[len]);
+            data = heap_.get();
+        }
+        env->GetByteArrayRegion(array, 0, len, data);
+        buf_.reset(new Buf(reinterpret_cast<const uint8_t *>(data), (size_t)len, false));
+    }
+    Buf* buf() const {
+        return buf_.get();
+    }
+private:
+    jbyte stack_[KEY_STACK_LEN];
+    std::unique_ptr<jbyte[]> heap_;
+    std::unique_ptr<Buf> buf_;
+};
+
+// a java array is indexed by an int, a longer value is only read by openInputStream.
+static const size_t MAX_ARRAY_LEN = INT32_MAX;
+
+static void throwTooLong(JNIEnv *env, size_t len){
+    throwException(env, "java/lang/IllegalStateException",
+                   "the value of " + std::to_string(len) + " bytes is too long for an array, read it with openInputStream");
+}
+
 static jbyteArray get(JNIEnv *env, jobject instance, jlong handle, jbyteArray array){
     KV* kv =  reinterpret_cast<KV *>(handle);
-    jsize key_len = env->GetArrayLength(array);
-    auto *key_ptr = env->GetByteArrayElements(array, nullptr);
-    env->GetByteArrayRegion(array, 0, key_len, key_ptr);
-
-    std::unique_ptr<Buf> key(new Buf(reinterpret_cast<const uint8_t *>(key_ptr), (size_t)key_len, false));
-    std::unique_ptr<Buf> ret = kv->Get(std::move(key));
+    JKey key(env, array);
     jbyteArray jret = nullptr;
-    if(ret != nullptr){
-        auto ret_len = (jsize) ret->len();
-        jret = env->NewByteArray(ret_len);
-        env->SetByteArrayRegion(
-                jret, 0, ret_len, reinterpret_cast<const jbyte*>(ret->ptr()));
+    bool failed = false;
+    size_t too_long = 0;
+    // the value is copied from the mapping into the java array directly.
+    bool found = kv->Get(key.buf(), [env, &jret, &failed, &too_long](const uint8_t* data, size_t len) {
+        if(failed){
+            return;
+        }
+        if(len > MAX_ARRAY_LEN){
+            too_long = len;
+            return;
+        }
+        too_long = 0;
+        auto ret_len = (jsize) len;
+        if(jret != nullptr && env->GetArrayLength(jret) != ret_len){
+            // rewritten meanwhile with another length.
+            env->DeleteLocalRef(jret);
+            jret = nullptr;
+        }
+        if(jret == nullptr){
+            jret = env->NewByteArray(ret_len);
+            if(jret == nullptr){
+                // OutOfMemoryError is pending.
+                failed = true;
+                return;
+            }
+        }
+        env->SetByteArrayRegion(jret, 0, ret_len, reinterpret_cast<const jbyte*>(data));
+    });
+    if(!found){
+        // what the sink copied was a torn value of a key deleted meanwhile.
+        return nullptr;
+    }
+    if(too_long > 0){
+        throwTooLong(env, too_long);
+        return nullptr;
     }
-    env->ReleaseByteArrayElements(array, key_ptr, 0);
     return jret;
 }
 
+static jobjectArray multiGet(JNIEnv *env, jobject instance, jlong handle, jobjectArray jkeys){
+    KV* kv =  reinterpret_cast<KV *>(handle);
+    jsize count = env->GetArrayLength(jkeys);
+    jclass byte_array_class = env->FindClass("[B");
+    jobjectArray jret = env->NewObjectArray(count, byte_array_class, nullptr);
+    env->DeleteLocalRef(byte_array_class);
+    if(jret == nullptr){
+        return nullptr;
+    }
+    // all the keys are copied in one buffer.
+    std::vector<jsize> offsets((size_t) count + 1, 0);
+    for(jsize i = 0; i < count; i++){
+        auto jkey = (jbyteArray) env->GetObjectArrayElement(jkeys, i);
+        offsets[i + 1] = offsets[i] + env->GetArrayLength(jkey);
+        env->DeleteLocalRef(jkey);
+    }
+    std::vector<jbyte> key_data((size_t) offsets[count]);
+    std::vector<std::unique_ptr<Buf>> keys;
+    std::vector<Buf*> key_ptrs;
+    for(jsize i = 0; i < count; i++){
+        auto jkey = (jbyteArray) env->GetObjectArrayElement(jkeys, i);
+        jsize len = offsets[i + 1] - offsets[i];
+        env->GetByteArrayRegion(jkey, 0, len, key_data.data() + offsets[i]);
+        env->DeleteLocalRef(jkey);
+        keys.emplace_back(new Buf(reinterpret_cast<const uint8_t *>(key_data.data() + offsets[i]), (size_t) len, false));
+        key_ptrs.push_back(keys.back().get());
+    }
+    bool failed = false;
+    // the length of each value too long for an array, by the last read of its key.
+    std::vector<size_t> too_long((size_t) count, 0);
+    std::vector<uint8_t> found;
+    kv->MultiGet(key_ptrs.data(), key_ptrs.size(), found, [env, jret, &failed, &too_long](size_t i, const uint8_t* data, size_t len) {
+        if(failed){
+            return;
+        }
+        if(len > MAX_ARRAY_LEN){
+            too_long[i] = len;
+            env->SetObjectArrayElement(jret, (jsize) i, nullptr);
+            return;
+        }
+        too_long[i] = 0;
+        // a value read again after a concurrent write just replaces the element.
+        jbyteArray value = env->NewByteArray((jsize) len);
+        if(value == nullptr){
+            // OutOfMemoryError is pending.
+            failed = true;
+            return;
+        }
+        env->SetByteArrayRegion(value, 0, (jsize) len, reinterpret_cast<const jbyte*>(data));
+        env->SetObjectArrayElement(jret, (jsize) i, value);
+        env->DeleteLocalRef(value);
+    });
+    if(failed){
+        return nullptr;
+    }
+    for(jsize i = 0; i < count; i++){
+        if(!found[i]){
+            // a torn value of a key deleted meanwhile.
+            env->SetObjectArrayElement(jret, i, nullptr);
+        }else if(too_long[i] > 0){
+            throwTooLong(env, too_long[i]);
+            return nullptr;
+        }
+    }
+    return jret;
+}
+
+static jint getInto(JNIEnv *env, jobject instance, jlong handle, jbyteArray array, jobject buffer, jint position, jint remaining){
+    KV* kv =  reinterpret_cast<KV *>(handle);
+    auto* dst = static_cast<uint8_t *>(env->GetDirectBufferAddress(buffer));
+    if(dst == nullptr){
+        return -1;
+    }
+    dst += position;
+    JKey key(env, array);
+    jint ret = -1;
+    size_t too_long = 0;
+    bool found = kv->Get(key.buf(), [dst, remaining, &ret, &too_long](const uint8_t* data, size_t len) {
+        if(len > MAX_ARRAY_LEN){
+            too_long = len;
+            return;
+        }
+        too_long = 0;
+        ret = (jint) len;
+        if(ret <= remaining){
+            memcpy(dst, data, len);
+        }
+    });
+    if(!found){
+        return -1;
+    }
+    if(too_long > 0){
+        throwTooLong(env, too_long);
+        return -1;
+    }
+    return ret;
+}
+
 static jboolean put(JNIEnv *env, jobject instance, jlong handle, jbyteArray jkey, jbyteArray jvalue){
     KV* kv =  reinterpret_cast<KV *>(handle);
     jsize key_len = env->GetArrayLength(jkey);
@@ -96,11 +260,136 @@ static void del(JNIEnv *env, jobject instance, jlong handle, jbyteArray array){
     env->ReleaseByteArrayElements(array, key_ptr, 0);
 }
 
+static jboolean writeBatch(JNIEnv *env, jobject instance, jlong handle, jbyteArray jbatch, jint len){
+    KV* kv =  reinterpret_cast<KV *>(handle);
+    auto *batch_ptr = env->GetByteArrayElements(jbatch, nullptr);
+    // the ops point into the java array, it's released once they are written.
+    WriteBatch batch;
+    bool ret = batch.parse(reinterpret_cast<const uint8_t *>(batch_ptr), (size_t) len) && kv->Write(batch);
+    env->ReleaseByteArrayElements(jbatch, batch_ptr, JNI_ABORT);
+    return ret;
+}
+
+static jlong cursorOpen(JNIEnv *env, jobject instance, jlong handle, jboolean keys_only){
+    KV* kv =  reinterpret_cast<KV *>(handle);
+    return reinterpret_cast<jlong>(kv->NewCursor(keys_only));
+}
+
+// packs the entries as key_len(2):key[:value_len(4):value], integers little endian. the scans leave the
+// values past INDEX_MAX_SCAN_VALUE_LEN out, so that the length fits.
+static EntrySink entry_packer(std::vector<uint8_t>& data){
+    return [&data](const uint8_t* key, size_t key_len, const uint8_t* value, size_t value_len) {
+        for(size_t i = 0; i < sizeof(uint16_t); i++){
+            data.push_back((uint8_t) (key_len >> (i * 8)));
+        }
+        data.insert(data.end(), key, key + key_len);
+        if(value != nullptr){
+            for(size_t i = 0; i < sizeof(uint32_t); i++){
+                data.push_back((uint8_t) (value_len >> (i * 8)));
+            }
+            data.insert(data.end(), value, value + value_len);
+        }
+    };
+}
+
+static jbyteArray to_byte_array(JNIEnv *env, const std::vector<uint8_t>& data){
+    if(data.size() > MAX_ARRAY_LEN){
+        throwException(env, "java/lang/OutOfMemoryError",
+                       "the entries take " + std::to_string(data.size()) + " bytes, read fewer at a time");
+        return nullptr;
+    }
+    jbyteArray jret = env->NewByteArray((jsize) data.size());
+    if(jret != nullptr){
+        env->SetByteArrayRegion(jret, 0, (jsize) data.size(), reinterpret_cast<const jbyte*>(data.data()));
+    }
+    return jret;
+}
+
+// the packed entries, empty at the end, null when the cursor broke.
+static jbyteArray cursorNext(JNIEnv *env, jobject instance, jlong handle, jint max){
+    auto* cursor = reinterpret_cast<Cursor *>(handle);
+    std::vector<uint8_t> data;
+    if(cursor->Next((uint32_t) max, entry_packer(data)) == CURSOR_BROKEN){
+        return nullptr;
+    }
+    return to_byte_array(env, data);
+}
+
+static void cursorClose(JNIEnv *env, jobject instance, jlong handle){
+    delete reinterpret_cast<Cursor *>(handle);
+}
+
+static jlong valueReaderOpen(JNIEnv *env, jobject instance, jlong handle, jbyteArray jkey){
+    KV* kv =  reinterpret_cast<KV *>(handle);
+    JKey key(env, jkey);
+    return reinterpret_cast<jlong>(kv->NewValueReader(key.buf()));
+}
+
+static jlong valueReaderLength(JNIEnv *env, jobject instance, jlong handle){
+    return (jlong) reinterpret_cast<ValueReader *>(handle)->len();
+}
+
+// copies the chunk from the mapping into the java array directly, the count of bytes, 0 at the end.
+static jint valueReaderRead(JNIEnv *env, jobject instance, jlong handle, jlong offset, jbyteArray dst, jint off, jint len){
+    auto* reader = reinterpret_cast<ValueReader *>(handle);
+    return (jint) reader->Read((uint64_t) offset, (size_t) len, [env, dst, off](const uint8_t* data, size_t n) {
+        env->SetByteArrayRegion(dst, off, (jsize) n, reinterpret_cast<const jbyte*>(data));
+    });
+}
+
+static void valueReaderClose(JNIEnv *env, jobject instance, jlong handle){
+    delete reinterpret_cast<ValueReader *>(handle);
+}
+
+static jlong valueWriterOpen(JNIEnv *env, jobject instance, jlong handle, jbyteArray jkey, jlong len){
+    KV* kv =  reinterpret_cast<KV *>(handle);
+    JKey key(env, jkey);
+    return reinterpret_cast<jlong>(kv->NewValueWriter(key.buf(), (uint64_t) std::max<jlong>(len, 0)));
+}
+
+// copies the chunk from the java array into the mapping directly.
+static jboolean valueWriterWrite(JNIEnv *env, jobject instance, jlong handle, jbyteArray src, jint off, jint len){
+    auto* writer = reinterpret_cast<ValueWriter *>(handle);
+    return writer->Write((size_t) len, [env, src, off](uint8_t* dst, size_t n) {
+        env->GetByteArrayRegion(src, off, (jsize) n, reinterpret_cast<jbyte*>(dst));
+    });
+}
+
+static jboolean valueWriterCommit(JNIEnv *env, jobject instance, jlong handle){
+    return reinterpret_cast<ValueWriter *>(handle)->Commit();
+}
+
+static void valueWriterClose(JNIEnv *env, jobject instance, jlong handle){
+    delete reinterpret_cast<ValueWriter *>(handle);
+}
+
+static jbyteArray scanPrefix(JNIEnv *env, jobject instance, jlong handle, jbyteArray jprefix, jboolean keys_only){
+    KV* kv =  reinterpret_cast<KV *>(handle);
+    JKey prefix(env, jprefix);
+    std::vector<uint8_t> data;
+    kv->ScanPrefix(prefix.buf(), keys_only, entry_packer(data));
+    return to_byte_array(env, data);
+}
+
+static jlong deletePrefix(JNIEnv *env, jobject instance, jlong handle, jbyteArray jprefix){
+    KV* kv =  reinterpret_cast<KV *>(handle);
+    JKey prefix(env, jprefix);
+    return kv->DeletePrefix(prefix.buf());
+}
+
 static void compact(JNIEnv *env, jobject instance, jlong handle){
     KV* kv =  reinterpret_cast<KV *>(handle);
     kv->Compact();
 }
 
+static jint maintainSeq(JNIEnv *env, jobject instance, jlong handle, jint kind){
+    KV* kv =  reinterpret_cast<KV *>(handle);
+    if(kind < 0 || kind >= MAINTAIN_KIND_COUNT){
+        return 0;
+    }
+    return (jint) kv->MaintainSeq(kind);
+}
+
 static void close(JNIEnv *env, jobject instance, jlong handle){
     KV* kv =  reinterpret_cast<KV *>(handle);
     delete kv;
@@ -114,11 +403,28 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void* reserved) {
     }
 
     JNINativeMethod emoKVMethods[] = {
-            {"nInit", "(Ljava/lang/String;JJJFI)J", (void *) initKV},
+            {"nInit", "(Ljava/lang/String;JJJFFJI)J", (void *) initKV},
             {"nGet", "(J[B)[B", (void *) get},
+            {"nMultiGet", "(J[[B)[[B", (void *) multiGet},
+            {"nGetInto", "(J[BLjava/nio/ByteBuffer;II)I", (void *) getInto},
             {"nPut", "(J[B[B)Z", (void *) put},
             {"nDelete", "(J[B)V", (void *) del},
+            {"nWrite", "(J[BI)Z", (void *) writeBatch},
+            {"nCursorOpen", "(JZ)J", (void *) cursorOpen},
+            {"nCursorNext", "(JI)[B", (void *) cursorNext},
+            {"nCursorClose", "(J)V", (void *) cursorClose},
+            {"nValueReaderOpen", "(J[B)J", (void *) valueReaderOpen},
+            {"nValueReaderLength", "(J)J", (void *) valueReaderLength},
+            {"nValueReaderRead", "(JJ[BII)I", (void *) valueReaderRead},
+            {"nValueReaderClose", "(J)V", (void *) valueReaderClose},
+            {"nValueWriterOpen", "(J[BJ)J", (void *) valueWriterOpen},
+            {"nValueWriterWrite", "(J[BII)Z", (void *) valueWriterWrite},
+            {"nValueWriterCommit", "(J)Z", (void *) valueWriterCommit},
+            {"nValueWriterClose", "(J)V", (void *) valueWriterClose},
+            {"nScanPrefix", "(J[BZ)[B", (void *) scanPrefix},
+            {"nDeletePrefix", "(J[B)J", (void *) deletePrefix},
             {"nCompact", "(J)V", (void *) compact},
+            {"nMaintainSeq", "(JI)I", (void *) maintainSeq},
             {"nClose", "(J)V", (void *) close}
     };
 
@@ -0,0 +1,165 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include "FreeSpace.h"
+
+namespace EmoKV {
+    // the extents of the class of a length are not all as long, this many of them are looked at.
+    static const size_t CLASS_SCAN = 8;
+
+    FreeSpace::FreeSpace() {
+        memset(used_, 0, sizeof(used_));
+    }
+
+    // 0-3 for the lengths below 4, then four classes for each power of two, by the two bits after
+    // the top one.
+    uint32_t FreeSpace::class_of(uint64_t len) {
+        if(len < 4){
+            return static_cast<uint32_t>(len);
+        }
+        auto top = static_cast<uint32_t>(63 - __builtin_clzll(len));
+        return (top - 1) * 4 + static_cast<uint32_t>((len >> (top - 2)) & 3);
+    }
+
+    void FreeSpace::add(uint64_t pos, uint64_t len) {
+        std::lock_guard<std::mutex> lock(lock_);
+        if(holding_){
+            held_.emplace_back(pos, len);
+            return;
+        }
+        free_locked(pos, len);
+    }
+
+    void FreeSpace::free_locked(uint64_t pos, uint64_t len) {
+        if(pins_ == 0){
+            add_locked(pos, len);
+        }else if(pinned_.size() < FREE_SPACE_MAX_EXTENTS){
+            pinned_.emplace_back(pos, len);
+        }
+    }
+
+    void FreeSpace::add_locked(uint64_t pos, uint64_t len) {
+        bool merged = false;
+        auto next = extents_.lower_bound(pos);
+        if(next != extents_.end() && next->first == pos + len){
+            len += next->second;
+            remove(next->first, next->second);
+            merged = true;
+        }
+        next = extents_.lower_bound(pos);
+        if(next != extents_.begin()){
+            auto last = std::prev(next);
+            if(last->first + last->second == pos){
+                pos = last->first;
+                len += last->second;
+                remove(last->first, last->second);
+                merged = true;
+            }
+        }
+        if(!merged && extents_.size() >= FREE_SPACE_MAX_EXTENTS){
+            return;
+        }
+        insert(pos, len);
+    }
+
+    void FreeSpace::insert(uint64_t pos, uint64_t len) {
+        uint32_t c = class_of(len);
+        extents_[pos] = len;
+        classes_[c].insert(pos);
+        used_[c / 64] |= 1ULL << (c % 64);
+    }
+
+    void FreeSpace::remove(uint64_t pos, uint64_t len) {
+        uint32_t c = class_of(len);
+        extents_.erase(pos);
+        classes_[c].erase(pos);
+        if(classes_[c].empty()){
+            used_[c / 64] &= ~(1ULL << (c % 64));
+        }
+    }
+
+    bool FreeSpace::take(uint64_t len, uint64_t& pos) {
+        std::lock_guard<std::mutex> lock(lock_);
+        uint32_t c = class_of(len);
+        uint64_t found = UINT64_MAX;
+        size_t scanned = 0;
+        for(auto it = classes_[c].begin(); it != classes_[c].end() && scanned < CLASS_SCAN; ++it, scanned++){
+            if(extents_[*it] >= len){
+                found = *it;
+                break;
+            }
+        }
+        // any extent of a larger class is long enough.
+        for(uint32_t word = (c + 1) / 64; found == UINT64_MAX && word < FREE_SPACE_CLASSES / 64; word++){
+            uint64_t bits = used_[word];
+            if(word == (c + 1) / 64){
+                bits &= ~0ULL << ((c + 1) % 64);
+            }
+            if(bits != 0){
+                found = *classes_[word * 64 + static_cast<uint32_t>(__builtin_ctzll(bits))].begin();
+            }
+        }
+        if(found == UINT64_MAX){
+            return false;
+        }
+        uint64_t found_len = extents_[found];
+        remove(found, found_len);
+        // the extents around are not free, or they would have been merged.
+        if(found_len > len){
+            insert(found + len, found_len - len);
+        }
+        pos = found;
+        return true;
+    }
+
+    void FreeSpace::hold() {
+        std::lock_guard<std::mutex> lock(lock_);
+        holding_ = true;
+    }
+
+    void FreeSpace::release(bool keep) {
+        std::lock_guard<std::mutex> lock(lock_);
+        holding_ = false;
+        if(keep){
+            for(auto& extent : held_){
+                free_locked(extent.first, extent.second);
+            }
+        }
+        held_.clear();
+    }
+
+    void FreeSpace::pin() {
+        std::lock_guard<std::mutex> lock(lock_);
+        pins_++;
+    }
+
+    void FreeSpace::unpin() {
+        std::lock_guard<std::mutex> lock(lock_);
+        if(--pins_ > 0){
+            return;
+        }
+        for(auto& extent : pinned_){
+            add_locked(extent.first, extent.second);
+        }
+        pinned_.clear();
+    }
+
+    void FreeSpace::rebuild(std::vector<std::pair<uint64_t, uint64_t>>& extents, uint64_t end) {
+        std::sort(extents.begin(), extents.end());
+        std::lock_guard<std::mutex> lock(lock_);
+        uint64_t pos = 0;
+        for(auto& extent : extents){
+            if(extent.first > pos){
+                add_locked(pos, extent.first - pos);
+            }
+            pos = std::max(pos, extent.first + extent.second);
+        }
+        if(end > pos){
+            add_locked(pos, end - pos);
+        }
+    }
+}
@@ -0,0 +1,69 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#ifndef EMO_FREE_SPACE_H
+#define EMO_FREE_SPACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+// size classes of free extents: four per power of two, up to any 64 bits length.
+#define FREE_SPACE_CLASSES 256
+// extents kept at most, the ones past it stay dead until a compaction.
+#define FREE_SPACE_MAX_EXTENTS 16384
+
+namespace EmoKV {
+
+    // The extents of the value storage no item points to any more, by size class, for new values to
+    // take before the storage is appended to. It's only kept in memory: on open it's rebuilt from the
+    // gaps between the live values, and a compaction of the storage starts a new one.
+    //
+    // An extent is only added once the item that pointed to it changed, under its seqlock, so a reader
+    // that still reads the old bytes sees the version move and reads again. Extents next to each other
+    // are merged when added, so that what's freed in pieces can be taken as a whole.
+    class FreeSpace {
+    public:
+        FreeSpace();
+        void add(uint64_t pos, uint64_t len);
+        // takes len bytes off a free extent of the smallest class that has them, the one the most in
+        // front of the storage. what's left of it stays free.
+        bool take(uint64_t len, uint64_t& pos);
+        // the extents added until release are only free if it keeps them: a rolled back batch points
+        // to them again.
+        void hold();
+        void release(bool keep);
+        // the extents added while pinned are only free once the last pin is gone: an open stream may
+        // still read the value that was there. see ValueStream.h.
+        void pin();
+        void unpin();
+        // the gaps below end between the extents, which are the live ones in any order.
+        void rebuild(std::vector<std::pair<uint64_t, uint64_t>>& extents, uint64_t end);
+
+    private:
+        std::mutex lock_;
+        // len of the extents by pos.
+        std::map<uint64_t, uint64_t> extents_;
+        // pos of the extents in each class.
+        std::set<uint64_t> classes_[FREE_SPACE_CLASSES];
+        // a bit per class that has extents.
+        uint64_t used_[FREE_SPACE_CLASSES / 64];
+        bool holding_ = false;
+        std::vector<std::pair<uint64_t, uint64_t>> held_;
+        uint32_t pins_ = 0;
+        std::vector<std::pair<uint64_t, uint64_t>> pinned_;
+        static uint32_t class_of(uint64_t len);
+        // adds the extent, or keeps it for unpin.
+        void free_locked(uint64_t pos, uint64_t len);
+        void add_locked(uint64_t pos, uint64_t len);
+        void insert(uint64_t pos, uint64_t len);
+        void remove(uint64_t pos, uint64_t len);
+    };
+}
+
+#endif //EMO_FREE_SPACE_H
@@ -3,36 +3,156 @@
 //
 
 #include <cstdlib>
+#include <chrono>
+#include <cstring>
+#include <random>
 #include <sys/mman.h>
 #include <thread>
 #include "Index.h"
-#include "../util/log.h"
+#include "../util/group.h"
+#include "../util/hash.h"
 
-// Header:
+// Header(INDEX_HEADER_LEN):
 // key_count(4), update_count(4), key_pos(8), value_pos(8)
-// ....reserved(12).
-// backup_item(item_size()), backup_index(4)
+// magic(4), version(4), seed(8), tombstone_count(4)
+// live_key_bytes(8), live_value_bytes(8), bytes_counted(4)
+// ....reserved.
+// backup_ctrl(1), backup_item(item_size()), backup_index(4)
+//
+// The legacy header(INDEX_LEGACY_HEADER_LEN) has no magic/version/seed and its
+// items are placed by a modulo of a byte-at-a-time hash. It is rehashed by copy_from on open.
+
+// Control bytes(capability):
+// one byte per item, 0 when the item is empty, 1 for a tombstone, else 0x80 | the top 7 bits of the key hash.
+// They are scanned GROUP_WIDTH at a time: a key lives in the first group with a free(empty or tombstone)
+// item along its probe sequence, which starts at the group of hash & mask and goes group by group.
+// Only the items whose control byte matches are read, and a lookup ends at the first group with an empty item.
+// A deleted item becomes empty again when its group still has an empty item: no probe sequence has ever
+// gone past that group. Else it becomes a tombstone, so that the sequences going through it stay unbroken.
+// Tombstones are reused by inserts and dropped when the index is rebuilt.
+// The live bytes are the key and value bytes in the storages that the items point to. The rest up to
+// key_pos/value_pos is dead, which is what a compaction gets back. The dead extents of the value storage
+// may be written again before, see FreeSpace.
+// bytes_counted is 0 in the files written before they were kept, they are counted on open then.
+// An index is grown or rebuilt by migrating its items into a new one a few at a time(migrate_to), the
+// new index takes over the header positions and all the writes meanwhile.
 
 // Item:
-// flag(1):key_len(1):key_data(8):value_len(2):value_data(8)
+// flag(1):key_len(1):key_data(16):value_len(2):value_data(8):value_len_high(4)
+// capability is a power of two and at least GROUP_WIDTH.
+// key_data holds the key itself when it's not longer than INDEX_INLINE_KEY_LEN(flag key_inline),
+// else the position in the key storage.
+// value_len_high holds the bits of the value length past the 16 of value_len, so that a value in the
+// value storage may be up to INDEX_MAX_VALUE_LEN. it was reserved before and always written as 0.
+//
+// Legacy items have an 8 bytes key_data and no value_len_high, and no control bytes: they are probed
+// item by item and only read by copy_from.
 namespace EmoKV {
+    static const size_t MAGIC_OFFSET = sizeof(uint32_t) * 2 + sizeof(uint64_t) * 2;
+    static const size_t VERSION_OFFSET = MAGIC_OFFSET + sizeof(uint32_t);
+    static const size_t SEED_OFFSET = VERSION_OFFSET + sizeof(uint32_t);
+    static const size_t TOMBSTONE_OFFSET = SEED_OFFSET + sizeof(uint64_t);
+    static const size_t LIVE_KEY_BYTES_OFFSET = TOMBSTONE_OFFSET + sizeof(uint32_t);
+    static const size_t LIVE_VALUE_BYTES_OFFSET = LIVE_KEY_BYTES_OFFSET + sizeof(uint64_t);
+    static const size_t BYTES_COUNTED_OFFSET = LIVE_VALUE_BYTES_OFFSET + sizeof(uint64_t);
+
+    // keys looked up together by read_multi, enough misses in flight for the memory system.
+    static const size_t MULTI_READ_WAVE = 16;
+    // a smaller index mostly stays in the cache, the waves only cost more than plain lookups there.
+    static const size_t MULTI_READ_PREFETCH_MIN_SIZE = 1024 * 1024;
+
+    // of any format version, for an item copied on the stack.
+    static const size_t ITEM_MAX_SIZE = 64;
+
+    static const uint8_t CTRL_EMPTY = 0;
+    static const uint8_t CTRL_TOMBSTONE = 1;
+
+    static inline void prefetch(const void* addr){
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(addr);
+#endif
+    }
+
+    static uint64_t gen_seed(){
+        std::random_device rd;
+        auto time = std::chrono::steady_clock::now().time_since_epoch().count();
+        return (static_cast<uint64_t>(rd()) << 32) ^ rd() ^ static_cast<uint64_t>(time);
+    }
+
     Index::Index(void* start, size_t size, IndexMode mode):
         start_(start),
-        size_(size),
         mode_(mode),
-        write_info_(WriteInfo { false, 0, 0}){
+        size_(size){
+        for(auto& version : versions_){
+            version.store(0);
+        }
         auto* s = static_cast<uint8_t *>(start_);
+        uint32_t magic;
+        memcpy(&magic, s + MAGIC_OFFSET, sizeof(uint32_t));
+        if(magic == INDEX_MAGIC){
+            memcpy(&version_, s + VERSION_OFFSET, sizeof(uint32_t));
+            memcpy(&seed_, s + SEED_OFFSET, sizeof(uint64_t));
+            header_len_ = INDEX_HEADER_LEN;
+        }else if(key_count() == 0 && key_pos() == 0 && value_pos() == 0){
+            // new file.
+            magic = INDEX_MAGIC;
+            version_ = INDEX_VERSION;
+            seed_ = gen_seed();
+            memcpy(s + MAGIC_OFFSET, &magic, sizeof(uint32_t));
+            memcpy(s + VERSION_OFFSET, &version_, sizeof(uint32_t));
+            memcpy(s + SEED_OFFSET, &seed_, sizeof(uint64_t));
+            uint32_t bytes_counted = 1;
+            memcpy(s + BYTES_COUNTED_OFFSET, &bytes_counted, sizeof(uint32_t));
+            header_len_ = INDEX_HEADER_LEN;
+        }else{
+            version_ = 0;
+            seed_ = 0;
+            header_len_ = INDEX_LEGACY_HEADER_LEN;
+        }
+        bool legacy = is_legacy();
+        size_t key_data_len = legacy ? sizeof(uint64_t) : INDEX_INLINE_KEY_LEN;
+        size_t ctrl_len = legacy ? 0 : sizeof(uint8_t);
+        key_offset_ = sizeof(uint8_t);
+        value_offset_ = key_offset_ + sizeof(uint8_t) + key_data_len;
+        item_size_ = legacy ? value_offset_ + sizeof(uint16_t) + sizeof(uint64_t) : item_size();
+
+        capability_ = size_ > header_len_ ? (size_ - header_len_) / (item_size_ + ctrl_len) : 0;
+        if(!legacy){
+            uint32_t cap = 1;
+            while (cap * 2 <= capability_){
+                cap *= 2;
+            }
+            capability_ = capability_ < GROUP_WIDTH ? 0 : cap;
+        }
+        mask_ = capability_ - 1;
+        ctrl_ = s + header_len_;
+        items_offset_ = header_len_ + capability_ * ctrl_len;
+
         uint32_t backup_index;
-        memcpy(&backup_index, s + INDEX_HEADER_LEN - sizeof(uint32_t), sizeof(uint32_t));
+        memcpy(&backup_index, s + header_len_ - sizeof(uint32_t), sizeof(uint32_t));
         if(backup_index < capability()){
-            size_t offset = INDEX_HEADER_LEN + backup_index * item_size();
+            size_t offset = item_offset(backup_index);
             uint8_t flag = *static_cast<uint8_t *>(s + offset);
             if(flag_is_editing(flag)){
-                //restore
-                memcpy(s + offset, s - INDEX_HEADER_LEN - item_size() - sizeof(uint32_t), item_size());
-                set_flag_editing(flag, false);
-                *static_cast<uint8_t *>(s + offset) = flag;
+                //restore, the backup is taken before the editing flag is set.
+                size_t backup_offset = header_len_ - item_size_ - sizeof(uint32_t);
+                memcpy(s + offset, s + backup_offset, item_size_);
+                if(!legacy){
+                    ctrl_[backup_index] = s[backup_offset - sizeof(uint8_t)];
+                }
+            }
+        }
+
+        uint32_t bytes_counted;
+        memcpy(&bytes_counted, s + BYTES_COUNTED_OFFSET, sizeof(uint32_t));
+        if(!legacy && bytes_counted == 0){
+            update_live_key_bytes(0);
+            update_live_value_bytes(0);
+            for(uint32_t i = 0; i < capability_; i++){
+                count_item(s + item_offset(i), true);
             }
+            bytes_counted = 1;
+            memcpy(s + BYTES_COUNTED_OFFSET, &bytes_counted, sizeof(uint32_t));
         }
     }
 
@@ -45,251 +165,741 @@ namespace EmoKV {
     }
 
     size_t Index::item_size(){
-        return sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint16_t) + sizeof(uint64_t);
+        return sizeof(uint8_t) * 6 + INDEX_INLINE_KEY_LEN + sizeof(uint16_t) + sizeof(uint64_t);
     }
 
-    std::unique_ptr<Buf> Index::read(Value* key_storage, Value* value_storage, Buf* key){
-        uint32_t index = key->hash(capability());
+    size_t Index::size_for(uint32_t capability){
+        return INDEX_HEADER_LEN + capability * (sizeof(uint8_t) + item_size());
+    }
+
+    size_t Index::item_offset(uint32_t index) const {
+        return items_offset_ + index * item_size_;
+    }
+
+    std::atomic<uint32_t>& Index::version_of(uint32_t index){
+        return versions_[index & (INDEX_VERSION_STRIPES - 1)];
+    }
+
+    // writes are serialized by the caller, so a plain store is enough to bump the version.
+    // every change of an item starts here, so it's also where a batch saves the item.
+    void Index::begin_write(uint32_t index){
+        if(undo_ != nullptr){
+            undo_->save(this, index);
+        }
+        auto& version = version_of(index);
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void Index::end_write(uint32_t index){
+        auto& version = version_of(index);
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    uint8_t Index::ctrl_of(uint64_t hash){
+        return static_cast<uint8_t>(0x80 | (hash >> 57));
+    }
+
+    uint32_t Index::probe_start(uint64_t hash) const {
+        return static_cast<uint32_t>(hash) & mask_ & ~(GROUP_WIDTH - 1);
+    }
+
+    bool Index::find(Value* key_storage, Buf* key, uint64_t hash, uint32_t& index, bool want_free) const {
+        uint8_t ctrl = ctrl_of(hash);
+        uint32_t group = probe_start(hash);
+        auto start = static_cast<uint8_t *>(start_);
+        uint32_t free_index = capability_;
+        for(uint32_t probed = 0; probed < capability_; probed += GROUP_WIDTH){
+            uint32_t match = group_match(ctrl_ + group, ctrl);
+            if(match != 0){
+                // pairs with the release in write: the item is filled before its control byte.
+                std::atomic_thread_fence(std::memory_order_acquire);
+            }
+            while (match != 0){
+                uint32_t i = group + group_first(match);
+                const uint8_t* item = start + item_offset(i);
+                if(flag_is_set(*item) && key_equal(key_storage, item, *item, key)){
+                    index = i;
+                    return true;
+                }
+                match &= match - 1;
+            }
+            uint32_t empty = group_match(ctrl_ + group, CTRL_EMPTY);
+            if(want_free && free_index == capability_){
+                uint32_t free = empty | group_match(ctrl_ + group, CTRL_TOMBSTONE);
+                if(free != 0){
+                    free_index = group + group_first(free);
+                }
+            }
+            if(empty != 0){
+                break;
+            }
+            group = (group + GROUP_WIDTH) & mask_;
+        }
+        index = free_index;
+        return false;
+    }
+
+    void Index::backup(uint32_t index){
+        auto start = static_cast<uint8_t *>(start_);
+        size_t backup_offset = header_len_ - item_size_ - sizeof(uint32_t);
+        start[backup_offset - sizeof(uint8_t)] = ctrl_[index];
+        memcpy(start + backup_offset, start + item_offset(index), item_size_);
+        memcpy(start + header_len_ - sizeof(uint32_t), &index, sizeof(uint32_t));
+    }
+
+    uint32_t Index::find_empty(uint64_t hash) const {
+        uint32_t group = probe_start(hash);
+        for(uint32_t probed = 0; probed < capability_; probed += GROUP_WIDTH){
+            uint32_t empty = group_match(ctrl_ + group, CTRL_EMPTY);
+            if(empty != 0){
+                return group + group_first(empty);
+            }
+            group = (group + GROUP_WIDTH) & mask_;
+        }
+        return capability_;
+    }
+
+    const uint8_t* Index::key_of(Value* key_storage, const uint8_t* item, uint8_t flag) const {
+        if(flag_is_key_inline(flag)){
+            return item + key_offset_ + sizeof(uint8_t);
+        }
+        uint64_t key_data;
+        memcpy(&key_data, item + key_offset_ + sizeof(uint8_t), sizeof(uint64_t));
+        return key_storage->view(key_data);
+    }
+
+    bool Index::key_equal(Value* key_storage, const uint8_t* item, uint8_t flag, Buf* key) const {
+        uint8_t key_len = item[key_offset_];
+        if(flag_is_key_inline(flag)){
+            return key->len() == key_len && memcmp(item + key_offset_ + sizeof(uint8_t), key->ptr(), key_len) == 0;
+        }
+        uint64_t key_data;
+        memcpy(&key_data, item + key_offset_ + sizeof(uint8_t), sizeof(uint64_t));
+        return key_storage->equal(key_data, key_len, key);
+    }
+
+    uint64_t Index::value_len_of(const uint8_t* item) const {
+        uint16_t low;
+        memcpy(&low, item + value_offset_, sizeof(uint16_t));
+        if(is_legacy()){
+            return low;
+        }
+        uint32_t high;
+        memcpy(&high, item + value_offset_ + sizeof(uint16_t) + sizeof(uint64_t), sizeof(uint32_t));
+        return static_cast<uint64_t>(high) << 16 | low;
+    }
+
+    void Index::set_value_len(uint8_t* item, uint64_t len) const {
+        auto low = static_cast<uint16_t>(len);
+        auto high = static_cast<uint32_t>(len >> 16);
+        memcpy(item + value_offset_, &low, sizeof(uint16_t));
+        memcpy(item + value_offset_ + sizeof(uint16_t) + sizeof(uint64_t), &high, sizeof(uint32_t));
+    }
+
+    bool Index::read(Value* key_storage, Value* value_storage, Buf* key, const ValueSink& sink){
+        return read_hashed(key_storage, value_storage, key, key->hash(seed_), sink);
+    }
+
+    bool Index::read_hashed(Value* key_storage, Value* value_storage, Buf* key, uint64_t hash, const ValueSink& sink){
+        auto start = static_cast<uint8_t *>(start_);
         while (true){
-            size_t init_offset = INDEX_HEADER_LEN + index * item_size();
-            size_t offset = init_offset;
-            auto start = static_cast<uint8_t *>(start_);
+            uint32_t index;
+            if(!find(key_storage, key, hash, index)){
+                return false;
+            }
+            auto& version = version_of(index);
+            uint32_t v = version.load(std::memory_order_acquire);
+            if((v & 1) == 1){
+                // there is a write to the item.
+                std::this_thread::yield();
+                continue;
+            }
+            size_t offset = item_offset(index);
             uint8_t flag =  *static_cast<uint8_t *>(start + offset);
-            if(!flag_is_set(flag)){
-                return {nullptr};
+            // the item may have been deleted and reused before the version was loaded, look it up again.
+            if(!flag_is_set(flag) || flag_is_deleted(flag) || !key_equal(key_storage, start + offset, flag, key)){
+                continue;
             }
-            offset += sizeof(uint8_t);
-            uint8_t key_len = *static_cast<uint8_t *>(start + offset);
-            offset += sizeof(uint8_t);
-            uint64_t key_data;
-            memcpy(&key_data, start + offset, sizeof(uint64_t));
-            auto k = key_storage->get(key_data, key_len);
-            if(k->equal(key)){
-                while (true){
-                    offset = init_offset;
-                    auto w_info = write_info_.load();
-                    if(w_info.writing && w_info.index == index){
-                        // there is a write action.
-                        std::this_thread::yield();
-                        continue;
-                    }
-                    flag =  *static_cast<uint8_t *>(start + offset);
-                    if(flag_is_deleted(flag)){
-                        return {nullptr};
-                    }
-                    offset += sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint64_t);
-                    uint16_t value_len;
-                    memcpy(&value_len, start + offset, sizeof(uint16_t));
-                    offset += sizeof(uint16_t);
-                    std::unique_ptr<Buf> ret;
-                    if(flag_is_ref(flag)){
-                        uint64_t value_data;
-                        memcpy(&value_data, start + offset, sizeof(uint64_t));
-                        ret = value_storage->get(value_data, value_len);
-                    }else{
-                        auto* copy_data = static_cast<uint8_t *>(malloc(value_len));
-                        memcpy(copy_data, start + offset, value_len);
-                        ret = std::unique_ptr<Buf>(new Buf(copy_data, value_len, true));
-                    }
-                    auto new_w_info = write_info_.load();
-                    if(new_w_info.version == w_info.version){
-                        // version not change, it's happy read.
-                        return ret;
+            uint64_t value_len = value_len_of(start + offset);
+            offset += value_offset_ + sizeof(uint16_t);
+            bool in_storage = true;
+            if(flag_is_ref(flag)){
+                uint64_t value_data;
+                memcpy(&value_data, start + offset, sizeof(uint64_t));
+                // a torn item may point out of the mapping, never hand that to the sink.
+                in_storage = value_storage->contains(value_data, value_len);
+                if(in_storage){
+                    sink(value_storage->view(value_data), value_len);
+                }
+            }else{
+                sink(start + offset, value_len);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(version.load(std::memory_order_relaxed) == v){
+                // no write to the item meanwhile, it's happy read.
+                // past the end of the mapping is only for a newer mapping of the storage to read.
+                return in_storage;
+            }
+            // the item may have changed, look the key up again.
+        }
+    }
+
+    uint32_t Index::likely_item(uint64_t hash) const {
+        uint32_t group = probe_start(hash);
+        uint32_t match = group_match(ctrl_ + group, ctrl_of(hash));
+        return match != 0 ? group + group_first(match) : capability_;
+    }
+
+    // Every stage touches the memory the previous one prefetched for all the keys of the wave:
+    // the control bytes, then the items, then the key and value bytes in the storages.
+    void Index::read_multi(Value* key_storage, Value* value_storage, Buf** keys, size_t count,
+                           std::vector<uint8_t>& found, const MultiValueSink& sink){
+        auto start = static_cast<uint8_t *>(start_);
+        uint64_t hashes[MULTI_READ_WAVE];
+        uint32_t items[MULTI_READ_WAVE];
+        size_t current = 0;
+        ValueSink one = [&sink, &current](const uint8_t* data, size_t len) {
+            sink(current, data, len);
+        };
+        if(size_ < MULTI_READ_PREFETCH_MIN_SIZE){
+            for(current = 0; current < count; current++){
+                if(!found[current]){
+                    found[current] = read(key_storage, value_storage, keys[current], one) ? 1 : 0;
+                }
+            }
+            return;
+        }
+        for(size_t wave = 0; wave < count; wave += MULTI_READ_WAVE){
+            size_t n = count - wave < MULTI_READ_WAVE ? count - wave : MULTI_READ_WAVE;
+            for(size_t i = 0; i < n; i++){
+                if(found[wave + i]){
+                    continue;
+                }
+                hashes[i] = keys[wave + i]->hash(seed_);
+                prefetch(ctrl_ + probe_start(hashes[i]));
+            }
+            for(size_t i = 0; i < n; i++){
+                if(found[wave + i]){
+                    continue;
+                }
+                items[i] = likely_item(hashes[i]);
+                if(items[i] != capability_){
+                    prefetch(start + item_offset(items[i]));
+                }
+            }
+            for(size_t i = 0; i < n; i++){
+                if(found[wave + i] || items[i] == capability_){
+                    continue;
+                }
+                // only a hint: a torn item at worst prefetches something useless.
+                const uint8_t* item = start + item_offset(items[i]);
+                uint8_t flag = *item;
+                uint64_t data;
+                if(flag_is_set(flag) && !flag_is_key_inline(flag)){
+                    memcpy(&data, item + key_offset_ + sizeof(uint8_t), sizeof(uint64_t));
+                    if(key_storage->contains(data, item[key_offset_])){
+                        prefetch(key_storage->view(data));
                     }
-                    // only one version update.
-                    if(new_w_info.version - w_info.version == 1){
-                        if(new_w_info.index == index){
-                            if(new_w_info.writing){
-                                std::this_thread::yield();
-                            }
-                            continue;
-                        }
-                        return ret;
+                }
+                if(flag_is_set(flag) && flag_is_ref(flag)){
+                    memcpy(&data, item + value_offset_ + sizeof(uint16_t), sizeof(uint64_t));
+                    if(value_storage->contains(data, 1)){
+                        prefetch(value_storage->view(data));
                     }
-                    // bad case: has more than one update, re read.
                 }
             }
-            index++;
-            if(index == capability()){
-                index = 0;
+            for(size_t i = 0; i < n; i++){
+                current = wave + i;
+                if(!found[current]){
+                    found[current] = read_hashed(key_storage, value_storage, keys[current], hashes[i], one) ? 1 : 0;
+                }
             }
         }
+    }
 
+    std::unique_ptr<Buf> Index::read(Value* key_storage, Value* value_storage, Buf* key){
+        std::unique_ptr<Buf> ret;
+        bool found = read(key_storage, value_storage, key, [&ret](const uint8_t* data, size_t len) {
+            auto* copy_data = static_cast<uint8_t *>(malloc(len));
+            memcpy(copy_data, data, len);
+            ret.reset(new Buf(copy_data, len, true));
+        });
+        // the sink may have seen a torn value of a key deleted meanwhile.
+        if(!found){
+            ret.reset();
+        }
+        return ret;
     }
+
     int Index::write(Value* key_storage, Value* value_storage, Buf* key, Buf* value){
-        uint32_t index = key->hash(capability());
-        bool is_update = false;
-        while (true){
-            size_t init_offset = INDEX_HEADER_LEN + index * item_size();
-            size_t offset = init_offset;
-            auto start = static_cast<uint8_t *>(start_);
-            uint8_t flag =  *static_cast<uint8_t *>(start + offset);
-            if(flag_is_set(flag)){
-                offset += sizeof(uint8_t);
-                uint8_t key_len = *static_cast<uint8_t *>(start + offset);
-                offset += sizeof(uint8_t);
-                uint64_t key_data;
-                memcpy(&key_data, start + offset, sizeof(uint64_t));
-                auto k = key_storage->get(key_data, key_len);
-                if(!k->equal(key)){
-                    index++;
-                    if(index == capability()){
-                        index = 0;
-                    }
-                    continue;
-                }
+        // fill the storages first: when one is full the item is left untouched for the retry.
+        uint64_t value_data = value_pos();
+        if(value->len() > sizeof(uint64_t) && value_storage->put(value_data, value->ptr(), value->len()) == -1){
+            // need expand value storage.
+            return -2;
+        }
+        int ret = write_at(key_storage, key, value, INDEX_NO_POS, value_data);
+        if(ret == -1){
+            uint64_t key_data = key_pos();
+            if(key_storage->put(key_data, key->ptr(), key->len()) == -1){
+                // need expand key storage.
+                return -1;
+            }
+            ret = write_at(key_storage, key, value, key_data, value_data);
+        }
+        return ret;
+    }
 
-                offset = init_offset;
-                // backup
-                memcpy(start + INDEX_HEADER_LEN - sizeof(uint32_t), &index, sizeof(uint32_t));
-                memcpy(start + INDEX_HEADER_LEN - item_size() - sizeof(uint32_t), start + offset, item_size());
-                set_flag_editing(flag, true);
-                *static_cast<uint8_t *>(start + offset) = flag;
-                is_update = true;
-            }else{
-                offset += sizeof(uint8_t);
-                *static_cast<uint8_t *>(start + offset) = static_cast<uint8_t>(key->len());
-                offset += sizeof(uint8_t);
-                uint64_t pos = key_pos();
-                int put_key = key_storage->put(pos, key->ptr(), key->len());
-                if(put_key == -1){
-                    // need expand key storage.
-                    return -1;
-                }
-                memcpy(start + offset, &pos, sizeof(uint64_t));
-                update_key_count(key_count() + 1);
-                update_key_pos(pos + key->len());
-            }
-            auto last = write_info_.load();
-            write_info_.store(WriteInfo{true, last.version + 1, index});
-            offset = init_offset + sizeof(uint8_t) * 2 + sizeof(uint64_t);
-            auto new_len = static_cast<uint16_t>(value->len());
-            memcpy(start + offset, &new_len, sizeof(uint16_t));
-            offset += sizeof(uint16_t);
-            if(value->len() <= sizeof(uint64_t)){
-                memcpy(start + offset, value->ptr(), value->len());
+    int Index::write_at(Value* key_storage, Buf* key, Buf* value, uint64_t key_data, uint64_t value_data){
+        uint64_t hash = key->hash(seed_);
+        uint32_t index;
+        bool is_update = find(key_storage, key, hash, index, true);
+        if(!is_update && index == capability_){
+            // need expand index.
+            return -3;
+        }
+        bool is_key_inline = key->len() <= INDEX_INLINE_KEY_LEN;
+        if(!is_update && !is_key_inline && key_data == INDEX_NO_POS){
+            // need the key in the key storage.
+            return -1;
+        }
+        bool is_ref = value->len() > sizeof(uint64_t);
+        size_t init_offset = item_offset(index);
+        size_t offset;
+        auto start = static_cast<uint8_t *>(start_);
+        uint8_t flag =  *static_cast<uint8_t *>(start + init_offset);
+        uint64_t dead_pos = INDEX_NO_POS;
+        uint64_t dead_len = 0;
+
+        begin_write(index);
+        offset = init_offset;
+        if(is_update){
+            if(flag_is_ref(flag)){
+                dead_len = value_len_of(start + init_offset);
+                memcpy(&dead_pos, start + init_offset + value_offset_ + sizeof(uint16_t), sizeof(uint64_t));
+            }
+            count_item(start + init_offset, false);
+            backup(index);
+            set_flag_editing(flag, true);
+            *static_cast<uint8_t *>(start + offset) = flag;
+            update_updated_count(updated_count() + 1);
+        }else{
+            offset += sizeof(uint8_t);
+            *static_cast<uint8_t *>(start + offset) = static_cast<uint8_t>(key->len());
+            offset += sizeof(uint8_t);
+            if(is_key_inline){
+                memcpy(start + offset, key->ptr(), key->len());
             }else{
-                uint64_t pos = value_pos();
-                int put_value = value_storage->put(pos, value->ptr(), value->len());
-                if(put_value == -1){
-                    // need expand value storage.
-                    set_flag_editing(flag, false);
-                    *static_cast<uint8_t *>(start + init_offset) = flag;
-                    write_info_.store(WriteInfo{true, last.version + 1, index});
-                    return -2;
+                memcpy(start + offset, &key_data, sizeof(uint64_t));
+                // space is placed by concurrent writers, they may publish out of order.
+                if(key_data + key->len() > key_pos()){
+                    update_key_pos(key_data + key->len());
                 }
-                memcpy(start + offset, &pos, sizeof(uint64_t));
-                update_value_pos(pos + value->len());
             }
-            if(is_update){
-                update_updated_count(updated_count() + 1);
+            set_flag_key_inline(flag, is_key_inline);
+            update_key_count(key_count() + 1);
+        }
+        // the high bits too: a reused item may have them from its last value.
+        set_value_len(start + init_offset, value->len());
+        offset = init_offset + value_offset_ + sizeof(uint16_t);
+        if(is_ref){
+            memcpy(start + offset, &value_data, sizeof(uint64_t));
+            if(value_data + value->len() > value_pos()){
+                update_value_pos(value_data + value->len());
             }
-            offset = init_offset;
-            set_flag_set(flag, true);
-            set_flag_deleted(flag, false);
-            set_flag_ref(flag, value->len() > sizeof(uint64_t));
-            set_flag_editing(flag, false);
-            *static_cast<uint8_t *>(start + offset) = flag;
-            write_info_.store(WriteInfo{false, 0, index});
-            return 0;
+        }else{
+            memcpy(start + offset, value->ptr(), value->len());
+        }
+        offset = init_offset;
+        set_flag_set(flag, true);
+        set_flag_deleted(flag, false);
+        set_flag_ref(flag, is_ref);
+        set_flag_editing(flag, false);
+        *static_cast<uint8_t *>(start + offset) = flag;
+        count_item(start + init_offset, true);
+        if(!is_update){
+            if(ctrl_[index] == CTRL_TOMBSTONE){
+                update_tombstone_count(tombstone_count() - 1);
+            }
+            // publish the item: readers only look at it once the control byte matches.
+            std::atomic_thread_fence(std::memory_order_release);
+            ctrl_[index] = ctrl_of(hash);
+        }
+        end_write(index);
+        if(dead_pos != INDEX_NO_POS && free_space_ != nullptr){
+            free_space_->add(dead_pos, dead_len);
         }
+        return 0;
     }
 
     void Index::del(Value *key_storage, Buf *key) {
-        uint32_t index = key->hash(capability());
-        bool ret = false;
-        do{
-            size_t init_offset = INDEX_HEADER_LEN + index * item_size();
-            size_t offset = init_offset;
-            auto start = static_cast<uint8_t *>(start_);
-            uint8_t flag =  *static_cast<uint8_t *>(start + offset);
-            if(flag_is_set(flag)){
-                offset += sizeof(uint8_t);
-                uint8_t key_len = *static_cast<uint8_t *>(start + offset);
-                offset += sizeof(uint8_t);
+        uint32_t index;
+        if(!find(key_storage, key, key->hash(seed_), index)){
+            return;
+        }
+        const uint8_t* item = static_cast<uint8_t *>(start_) + item_offset(index);
+        uint64_t dead_pos = INDEX_NO_POS;
+        uint64_t dead_len = 0;
+        if(flag_is_ref(*item)){
+            dead_len = value_len_of(item);
+            memcpy(&dead_pos, item + value_offset_ + sizeof(uint16_t), sizeof(uint64_t));
+        }
+        erase(index);
+        if(dead_pos != INDEX_NO_POS && free_space_ != nullptr){
+            free_space_->add(dead_pos, dead_len);
+        }
+    }
+
+    bool Index::extent_of(Value* key_storage, Buf* key, uint32_t& index, uint64_t& pos, uint64_t& len) const {
+        if(!find(key_storage, key, key->hash(seed_), index)){
+            return false;
+        }
+        const uint8_t* item = static_cast<uint8_t *>(start_) + item_offset(index);
+        if(!flag_is_ref(*item)){
+            return false;
+        }
+        len = value_len_of(item);
+        memcpy(&pos, item + value_offset_ + sizeof(uint16_t), sizeof(uint64_t));
+        return true;
+    }
+
+    // the readers of the value check the version of the item after, like for any write to it. a crash
+    // leaves the item with its backup and the value with the caller's ValueBackup.
+    void Index::overwrite_at(uint32_t index, Value* value_storage, Buf* value) {
+        auto start = static_cast<uint8_t *>(start_);
+        uint8_t* item = start + item_offset(index);
+        uint8_t flag = *item;
+        uint64_t pos;
+        memcpy(&pos, item + value_offset_ + sizeof(uint16_t), sizeof(uint64_t));
+        begin_write(index);
+        count_item(item, false);
+        backup(index);
+        set_flag_editing(flag, true);
+        *item = flag;
+        value_storage->put(pos, value->ptr(), value->len());
+        set_value_len(item, value->len());
+        set_flag_editing(flag, false);
+        *item = flag;
+        count_item(item, true);
+        update_updated_count(updated_count() + 1);
+        end_write(index);
+    }
+
+    void Index::restore_value_len(uint32_t index, uint64_t pos, uint64_t len) {
+        if(index >= capability_){
+            return;
+        }
+        uint8_t* item = static_cast<uint8_t *>(start_) + item_offset(index);
+        uint64_t value_pos;
+        memcpy(&value_pos, item + value_offset_ + sizeof(uint16_t), sizeof(uint64_t));
+        if(!flag_is_set(*item) || !flag_is_ref(*item) || value_pos != pos){
+            return;
+        }
+        count_item(item, false);
+        set_value_len(item, len);
+        count_item(item, true);
+    }
+
+    bool Index::contains(Value* key_storage, Buf* key) const {
+        uint32_t index;
+        return find(key_storage, key, key->hash(seed_), index);
+    }
+
+    uint32_t Index::copy_item(uint32_t index, uint8_t* item) {
+        auto start = static_cast<uint8_t *>(start_);
+        auto& version = version_of(index);
+        uint32_t v;
+        do {
+            v = version.load(std::memory_order_acquire);
+            if((v & 1) == 1){
+                std::this_thread::yield();
+                continue;
+            }
+            memcpy(item, start + item_offset(index), item_size_);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((v & 1) == 1 || version.load(std::memory_order_relaxed) != v);
+        return v;
+    }
+
+    // the item is copied under its seqlock first, so that each one reaches the sink once. a value may be
+    // overwritten in place(overwrite_at) after, so it's copied out too before the version is checked again.
+    uint32_t Index::scan(Value* key_storage, Value* value_storage, uint32_t& from, uint32_t max, bool keys_only,
+                         const EntrySink& sink) {
+        uint8_t item[ITEM_MAX_SIZE];
+        std::vector<uint8_t> value_copy;
+        uint32_t count = 0;
+        for(; from < capability_ && count < max; from++){
+            if((ctrl_[from] & 0x80) == 0){
+                continue;
+            }
+            uint32_t v = copy_item(from, item);
+            uint8_t flag = item[0];
+            if(!flag_is_set(flag) || flag_is_deleted(flag)){
+                continue;
+            }
+            uint8_t key_len = item[key_offset_];
+            const uint8_t* key = item + key_offset_ + sizeof(uint8_t);
+            if(!flag_is_key_inline(flag)){
                 uint64_t key_data;
-                memcpy(&key_data, start + offset, sizeof(uint64_t));
-                auto k = key_storage->get(key_data, key_len);
-                if(!k->equal(key)){
-                    index++;
-                    if(index == capability()){
-                        index = 0;
-                    }
-                }else{
-                    if(!flag_is_deleted(flag)){
-                        set_flag_deleted(flag, true);
-                        *static_cast<uint8_t *>(start + init_offset) = flag;
-                    }
-                    ret = true;
+                memcpy(&key_data, key, sizeof(uint64_t));
+                if(!key_storage->contains(key_data, key_len)){
+                    return count;
                 }
-            }else{
-                return;
+                key = key_storage->view(key_data);
+            }
+            uint64_t value_len = value_len_of(item);
+            if(!keys_only && value_len > INDEX_MAX_SCAN_VALUE_LEN){
+                continue;
             }
-        } while (!ret);
+            const uint8_t* value = item + value_offset_ + sizeof(uint16_t);
+            if(keys_only){
+                value = nullptr;
+            }else if(flag_is_ref(flag)){
+                uint64_t value_data;
+                memcpy(&value_data, value, sizeof(uint64_t));
+                if(!value_storage->contains(value_data, value_len)){
+                    return count;
+                }
+                const uint8_t* data = value_storage->view(value_data);
+                value_copy.assign(data, data + value_len);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if(version_of(from).load(std::memory_order_relaxed) != v){
+                    // read the item again.
+                    from--;
+                    continue;
+                }
+                value = value_copy.data();
+            }
+            sink(key, key_len, value, value_len);
+            count++;
+        }
+        return count;
+    }
+
+    void Index::erase(uint32_t index) {
+        auto start = static_cast<uint8_t *>(start_);
+        size_t offset = item_offset(index);
+        uint8_t flag =  *static_cast<uint8_t *>(start + offset);
+        begin_write(index);
+        count_item(start + offset, false);
+        // a crash before the flag is cleared brings the item back on open.
+        backup(index);
+        set_flag_editing(flag, true);
+        *static_cast<uint8_t *>(start + offset) = flag;
+        uint32_t group = index & ~(GROUP_WIDTH - 1);
+        bool reclaim = group_match(ctrl_ + group, CTRL_EMPTY) != 0;
+        ctrl_[index] = reclaim ? CTRL_EMPTY : CTRL_TOMBSTONE;
+        *static_cast<uint8_t *>(start + offset) = 0;
+        update_key_count(key_count() - 1);
+        if(!reclaim){
+            update_tombstone_count(tombstone_count() + 1);
+        }
+        end_write(index);
+    }
+
+    void Index::inherit_from(Index* from) {
+        update_updated_count(from->updated_count());
+        update_key_pos(from->key_pos());
+        update_value_pos(from->value_pos());
+    }
+
+    bool Index::migrate_to(Value* key_storage, Index* to, uint32_t& from, uint32_t count) {
+        uint32_t end = count < capability_ - from ? from + count : capability_;
+        for(; from < end; from++){
+            if((ctrl_[from] & 0x80) != 0 && !move_item(key_storage, to, from)){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Index::migrate_key_to(Value* key_storage, Index* to, Buf* key) {
+        uint32_t index;
+        if(!find(key_storage, key, key->hash(seed_), index)){
+            return true;
+        }
+        return move_item(key_storage, to, index);
+    }
+
+    // the item is published in `to` before it's erased here: a reader that looks here first and
+    // then in `to` always finds it in one of them. A crash in between leaves the same item in both,
+    // which the next move just erases here.
+    bool Index::move_item(Value* key_storage, Index* to, uint32_t index) {
+        auto start = static_cast<uint8_t *>(start_);
+        const uint8_t* item = start + item_offset(index);
+        uint8_t flag = *item;
+        if(!flag_is_set(flag)){
+            return true;
+        }
+        Buf key(key_of(key_storage, item, flag), item[key_offset_], false);
+        uint64_t hash = key.hash(to->seed_);
+        uint32_t target;
+        if(!to->find(key_storage, &key, hash, target, true)){
+            if(target == to->capability_){
+                return false;
+            }
+            to->insert_item(target, hash, item);
+        }
+        erase(index);
+        return true;
+    }
+
+    void Index::insert_item(uint32_t index, uint64_t hash, const uint8_t* item) {
+        auto start = static_cast<uint8_t *>(start_);
+        begin_write(index);
+        memcpy(start + item_offset(index), item, item_size_);
+        count_item(item, true);
+        if(ctrl_[index] == CTRL_TOMBSTONE){
+            update_tombstone_count(tombstone_count() - 1);
+        }
+        update_key_count(key_count() + 1);
+        std::atomic_thread_fence(std::memory_order_release);
+        ctrl_[index] = ctrl_of(hash);
+        end_write(index);
     }
 
     void Index::copy_from(Value *key_storage, Index *from) {
         update_updated_count(0);
+        update_live_key_bytes(0);
+        update_live_value_bytes(0);
         update_key_pos(from->key_pos());
         update_value_pos(from->value_pos());
-        size_t is = item_size();
-        auto from_start = static_cast<uint8_t *>(from->start_);
         auto target_start = static_cast<uint8_t *>(start_);
         auto from_cap = from->capability();
+        uint8_t from_item[ITEM_MAX_SIZE];
         uint32_t key_count = 0;
-        for(size_t i = 0; i < from_cap; i++){
-            size_t from_init_offset = INDEX_HEADER_LEN + i * is;
-            size_t from_offset = from_init_offset;
-            uint8_t flag =  *static_cast<uint8_t *>(from_start + from_offset);
+        for(uint32_t i = 0; i < from_cap; i++){
+            from->copy_item(i, from_item);
+            uint8_t flag = *from_item;
             if(flag_is_set(flag) && !flag_is_deleted(flag)){
-                from_offset += sizeof(uint8_t);
-                uint8_t key_len = *static_cast<uint8_t *>(from_start + from_offset);
-                from_offset += sizeof(uint8_t);
-                uint64_t key_data;
-                memcpy(&key_data, from_start + from_offset, sizeof(uint64_t));
-                auto k = key_storage->get(key_data, key_len);
-                uint32_t target_index = k->hash(capability());
-                while (true){
-                    size_t target_offset = INDEX_HEADER_LEN + target_index * is;
-                    uint8_t target_flag = *static_cast<uint8_t *>(target_start + target_offset);
-                    if(flag_is_set(target_flag)){
-                        target_index ++;
-                        if(target_index == capability()){
-                            target_index = 0;
-                        }
+                uint8_t key_len = from_item[from->key_offset_];
+                const uint8_t* key_data = from_item + from->key_offset_ + sizeof(uint8_t);
+                if(!flag_is_key_inline(flag)){
+                    uint64_t key_pos;
+                    memcpy(&key_pos, key_data, sizeof(uint64_t));
+                    if(!key_storage->contains(key_pos, key_len)){
+                        // placed past the mapping by a writer still going on, see KV::compact_files.
                         continue;
                     }
-                    memcpy(target_start + target_offset, from_start + from_init_offset, is);
-                    key_count++;
+                }
+                const uint8_t* key_ptr = from->key_of(key_storage, from_item, flag);
+                uint64_t hash = hash_bytes(key_ptr, key_len, seed_);
+                uint32_t target_index = find_empty(hash);
+                if(target_index == capability_){
+                    // the target is too small, the caller sizes it from the key count.
                     break;
                 }
-
+                uint8_t* target_item = target_start + item_offset(target_index);
+                // keys of an older format stored in the key storage move inline when they fit.
+                bool is_key_inline = key_len <= INDEX_INLINE_KEY_LEN;
+                set_flag_key_inline(flag, is_key_inline);
+                target_item[0] = flag;
+                target_item[key_offset_] = key_len;
+                if(is_key_inline){
+                    memcpy(target_item + key_offset_ + sizeof(uint8_t), key_ptr, key_len);
+                }else{
+                    memcpy(target_item + key_offset_ + sizeof(uint8_t), key_data, sizeof(uint64_t));
+                }
+                memcpy(target_item + value_offset_ + sizeof(uint16_t),
+                       from_item + from->value_offset_ + sizeof(uint16_t),
+                       sizeof(uint64_t));
+                set_value_len(target_item, from->value_len_of(from_item));
+                ctrl_[target_index] = ctrl_of(hash);
+                count_item(target_item, true);
+                key_count++;
             }
         }
         update_key_count(key_count);
     }
 
-    void Index::compact(Value* from_storage, Value* to_storage){
+    bool Index::compact(Value* from_storage, Value* to_storage){
         uint64_t pos = 0;
-        size_t is = item_size();
         auto start = static_cast<uint8_t *>(start_);
         auto cap = capability();
         for(size_t i = 0; i < cap; i++){
-            size_t offset = INDEX_HEADER_LEN + i * is;
+            size_t offset = item_offset(i);
             uint8_t flag =  *static_cast<uint8_t *>(start + offset);
             if(flag_is_set(flag) && !flag_is_deleted(flag) && flag_is_ref(flag)){
-                offset += sizeof(uint8_t) * 2 + sizeof(uint64_t);
-                uint16_t value_len;
-                memcpy(&value_len, start + offset, sizeof(uint16_t));
-                offset += sizeof(uint16_t);
+                uint64_t value_len = value_len_of(start + offset);
+                offset += value_offset_ + sizeof(uint16_t);
                 uint64_t value_pos;
                 memcpy(&value_pos, start + offset, sizeof(uint64_t));
+                if(!to_storage->contains(pos, value_len)){
+                    return false;
+                }
+                if(!from_storage->contains(value_pos, value_len)){
+                    // written again once the copy is done, see KV::compact_files.
+                    continue;
+                }
                 from_storage->copy_to(to_storage, value_pos, pos, value_len);
                 memcpy(start + offset, &pos, sizeof(uint64_t));
                 pos += value_len;
             }
         }
         update_value_pos(pos);
+        return true;
+    }
+
+    bool Index::compact_keys(Value* from_storage, Value* to_storage){
+        uint64_t pos = 0;
+        auto start = static_cast<uint8_t *>(start_);
+        auto cap = capability();
+        for(size_t i = 0; i < cap; i++){
+            size_t offset = item_offset(i);
+            uint8_t flag =  *static_cast<uint8_t *>(start + offset);
+            if(flag_is_set(flag) && !flag_is_deleted(flag) && !flag_is_key_inline(flag)){
+                offset += key_offset_;
+                uint8_t key_len = start[offset];
+                offset += sizeof(uint8_t);
+                uint64_t key_pos;
+                memcpy(&key_pos, start + offset, sizeof(uint64_t));
+                if(!to_storage->contains(pos, key_len)){
+                    return false;
+                }
+                from_storage->copy_to(to_storage, key_pos, pos, key_len);
+                memcpy(start + offset, &pos, sizeof(uint64_t));
+                pos += key_len;
+            }
+        }
+        update_key_pos(pos);
+        return true;
+    }
+
+    void Index::count_item(const uint8_t* item, bool add){
+        uint8_t flag = item[0];
+        if(!flag_is_set(flag) || flag_is_deleted(flag)){
+            return;
+        }
+        if(!flag_is_key_inline(flag)){
+            uint8_t key_len = item[key_offset_];
+            update_live_key_bytes(add ? live_key_bytes() + key_len : live_key_bytes() - key_len);
+        }
+        if(flag_is_ref(flag)){
+            uint64_t value_len = value_len_of(item);
+            update_live_value_bytes(add ? live_value_bytes() + value_len : live_value_bytes() - value_len);
+        }
+    }
+
+    void Index::set_undo(UndoLog* undo) {
+        undo_ = undo;
+    }
+
+    void Index::set_free_space(FreeSpace* free_space) {
+        free_space_ = free_space;
+    }
+
+    void Index::value_extents(std::vector<std::pair<uint64_t, uint64_t>>& extents) {
+        auto start = static_cast<uint8_t *>(start_);
+        for(uint32_t i = 0; i < capability_; i++){
+            const uint8_t* item = start + item_offset(i);
+            if(!flag_is_set(*item) || flag_is_deleted(*item) || !flag_is_ref(*item)){
+                continue;
+            }
+            uint64_t pos;
+            memcpy(&pos, item + value_offset_ + sizeof(uint16_t), sizeof(uint64_t));
+            extents.emplace_back(pos, value_len_of(item));
+        }
     }
 
     size_t Index::size() const {
@@ -308,6 +918,30 @@ namespace EmoKV {
         return value;
     }
 
+    uint32_t Index::tombstone_count(){
+        if(is_legacy()){
+            return 0;
+        }
+        auto start = static_cast<uint8_t *>(start_);
+        uint32_t value;
+        memcpy(&value, start + TOMBSTONE_OFFSET, sizeof(uint32_t));
+        return value;
+    }
+
+    uint64_t Index::live_key_bytes(){
+        auto start = static_cast<uint8_t *>(start_);
+        uint64_t value;
+        memcpy(&value, start + LIVE_KEY_BYTES_OFFSET, sizeof(uint64_t));
+        return value;
+    }
+
+    uint64_t Index::live_value_bytes(){
+        auto start = static_cast<uint8_t *>(start_);
+        uint64_t value;
+        memcpy(&value, start + LIVE_VALUE_BYTES_OFFSET, sizeof(uint64_t));
+        return value;
+    }
+
     uint64_t Index::key_pos(){
         auto start = static_cast<uint8_t *>(start_);
         uint64_t value;
@@ -323,7 +957,15 @@ namespace EmoKV {
     }
 
     uint32_t Index::capability() const {
-        return (size_ - INDEX_HEADER_LEN) / item_size();
+        return capability_;
+    }
+
+    uint64_t Index::seed() const {
+        return seed_;
+    }
+
+    bool Index::is_legacy() const {
+        return version_ < INDEX_VERSION;
     }
     bool Index::flag_is_set(uint8_t flag){
         return (flag & 0x1) == 0x1;
@@ -340,6 +982,10 @@ namespace EmoKV {
         return (flag & 0x8) == 0x8;
     }
 
+    bool Index::flag_is_key_inline(uint8_t flag) {
+        return (flag & 0x10) == 0x10;
+    }
+
     void Index::set_flag_set(uint8_t& flag, bool set){
         if(set){
             flag |= 0x1;
@@ -372,6 +1018,14 @@ namespace EmoKV {
         }
     }
 
+    void Index::set_flag_key_inline(uint8_t &flag, bool inline_key) {
+        if(inline_key){
+            flag |= 0x10;
+        }else{
+            flag &= ~0x10;
+        }
+    }
+
     void Index::update_key_count(uint32_t count){
         memcpy(start_, &count, sizeof(uint32_t));
     }
@@ -379,6 +1033,18 @@ namespace EmoKV {
         auto * start = static_cast<uint8_t *>(start_);
         memcpy(start + sizeof(uint32_t), &count, sizeof(uint32_t));
     }
+    void Index::update_tombstone_count(uint32_t count){
+        auto * start = static_cast<uint8_t *>(start_);
+        memcpy(start + TOMBSTONE_OFFSET, &count, sizeof(uint32_t));
+    }
+    void Index::update_live_key_bytes(uint64_t bytes){
+        auto * start = static_cast<uint8_t *>(start_);
+        memcpy(start + LIVE_KEY_BYTES_OFFSET, &bytes, sizeof(uint64_t));
+    }
+    void Index::update_live_value_bytes(uint64_t bytes){
+        auto * start = static_cast<uint8_t *>(start_);
+        memcpy(start + LIVE_VALUE_BYTES_OFFSET, &bytes, sizeof(uint64_t));
+    }
     void Index::update_key_pos(uint64_t pos){
         auto * start = static_cast<uint8_t *>(start_);
         memcpy(start + sizeof(uint32_t) * 2, &pos, sizeof(uint64_t));
@@ -6,11 +6,34 @@
 #define EMO_INDEX_H
 
 #include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <vector>
 #include "../Buf.h"
 #include "Value.h"
+#include "UndoLog.h"
+#include "FreeSpace.h"
 
-#define INDEX_HEADER_LEN 64
+#define INDEX_HEADER_LEN 128
+// header of the stores written before the index had a format version.
+#define INDEX_LEGACY_HEADER_LEN 64
+#define INDEX_MAGIC 0x49564B45
+#define INDEX_VERSION 4
+#define INDEX_MIN_CAPABILITY 16
+// keys up to this length are kept in the item instead of the key storage.
+#define INDEX_INLINE_KEY_LEN 16
+// items share a version counter with the ones at the same index modulo this, a power of two.
+#define INDEX_VERSION_STRIPES 1024
+// no position in a storage.
+#define INDEX_NO_POS UINT64_MAX
+// keys are as long as a key_len byte holds, values as 48 bits, see the item layout in Index.cpp.
+#define INDEX_MAX_KEY_LEN UINT8_MAX
+#define INDEX_MAX_VALUE_LEN ((1ULL << 48) - 1)
+// longer values are left out of the scans with values, which copy them whole into a java array along
+// with their key. they are read a chunk at a time with a ValueReader instead.
+#define INDEX_MAX_SCAN_VALUE_LEN (INT32_MAX - 1024)
 
 namespace EmoKV {
     enum IndexMode {
@@ -18,46 +41,147 @@ namespace EmoKV {
         MEMORY
     };
 
-    struct WriteInfo {
-        bool writing;
-        uint32_t version;
-        uint32_t index;
-    };
+    // receives a value straight from the mapping, the data is only valid during the call.
+    // it's called again if a write to the item is detected meanwhile, the last call wins. it may be called
+    // with a torn value of a key deleted meanwhile, so its calls only count when the read returns true.
+    typedef std::function<void(const uint8_t* data, size_t len)> ValueSink;
+    // the same for the i-th key of a multi read.
+    typedef std::function<void(size_t i, const uint8_t* data, size_t len)> MultiValueSink;
+    // receives a live item of a scan, value is null for a keys only scan. only valid during the call.
+    typedef std::function<void(const uint8_t* key, size_t key_len, const uint8_t* value, size_t value_len)> EntrySink;
 
     class Index {
     public:
         Index(void* start, size_t size, IndexMode mode);
         ~Index();
+        bool read(Value* key_storage, Value* value_storage, Buf* key, const ValueSink& sink);
         std::unique_ptr<Buf> read(Value* key_storage, Value* value_storage, Buf* key);
+        // reads every keys[i] whose found[i] is false and sets it for the hits. the keys are looked up
+        // in waves whose memory is prefetched ahead, so that their cache misses overlap.
+        void read_multi(Value* key_storage, Value* value_storage, Buf** keys, size_t count,
+                        std::vector<uint8_t>& found, const MultiValueSink& sink);
+        // appends to the storages at key_pos()/value_pos(), -1/-2 when the key/value storage is full.
         int write(Value* key_storage, Value* value_storage, Buf* key, Buf* value);
+        // writes the item of key with the bytes the caller placed in the storages already: value_data
+        // when the value doesn't fit in the item, key_data(or INDEX_NO_POS) when the key doesn't.
+        // -1 when the key is new and key_data is needed, -3 when the index is full.
+        int write_at(Value* key_storage, Buf* key, Buf* value, uint64_t key_data, uint64_t value_data);
+        // the item of key when its value is in the value storage, with the position and length it has there.
+        bool extent_of(Value* key_storage, Buf* key, uint32_t& index, uint64_t& pos, uint64_t& len) const;
+        // writes value over the one of the item in value_storage, see extent_of. it must not be longer.
+        void overwrite_at(uint32_t index, Value* value_storage, Buf* value);
+        // puts back the value length of the item if its value is still at pos, see ValueBackup.
+        void restore_value_len(uint32_t index, uint64_t pos, uint64_t len);
         void del(Value* key_storage, Buf* key);
+        bool contains(Value* key_storage, Buf* key) const;
+        // hands the live items from index `from` on to sink until max of them are read, and advances from
+        // past them. it stops early, at the item, when the item points past the end of a storage mapping.
+        // unless keys_only, the items with a value past INDEX_MAX_SCAN_VALUE_LEN are skipped.
+        uint32_t scan(Value* key_storage, Value* value_storage, uint32_t& from, uint32_t max, bool keys_only,
+                      const EntrySink& sink);
         size_t size() const;
         uint32_t key_count();
         uint32_t updated_count();
+        // deleted items that still take a place on probe sequences, see Index.cpp.
+        uint32_t tombstone_count();
         uint32_t capability() const;
+        uint64_t seed() const;
+        // written by an older format version, it's only usable as the source of copy_from.
+        bool is_legacy() const;
         uint64_t key_pos();
         uint64_t value_pos();
+        // from may be written meanwhile, its items are read under their seqlock. the ones with a key past
+        // the end of key_storage are left out.
         void copy_from(Value* key_storage, Index* from);
-        void compact(Value* from_storage, Value* to_storage);
+        // starts an incremental migration into this index: takes over the storage positions and counts.
+        void inherit_from(Index* from);
+        // moves the live items of [from, from + count) into `to` and advances from past them.
+        // false when `to` is full, the items left are moved by a later call.
+        bool migrate_to(Value* key_storage, Index* to, uint32_t& from, uint32_t count);
+        // moves the key into `to` if it's still here, so that it can be written there.
+        bool migrate_key_to(Value* key_storage, Index* to, Buf* key);
+        // items with a value out of from_storage keep pointing at it, for the caller to write again.
+        // false when to_storage is too small.
+        bool compact(Value* from_storage, Value* to_storage);
+        // the same for the keys that are not inline. they are laid out in slot order, so the keys met
+        // on a probe sequence are next to each other.
+        bool compact_keys(Value* from_storage, Value* to_storage);
+        // the bytes of the key and value storages the items point to, see Index.cpp.
+        uint64_t live_key_bytes();
+        uint64_t live_value_bytes();
+        // items are saved to undo before they change, until it's set back to null. see UndoLog.
+        void set_undo(UndoLog* undo);
+        // the values that write_at replaces and del removes are added to it, unless it's null.
+        void set_free_space(FreeSpace* free_space);
+        // appends the position and length of the live values in the value storage.
+        void value_extents(std::vector<std::pair<uint64_t, uint64_t>>& extents);
         static bool flag_is_set(uint8_t flag);
         static bool flag_is_ref(uint8_t flag);
         static bool flag_is_editing(uint8_t flag);
         static bool flag_is_deleted(uint8_t flag);
+        static bool flag_is_key_inline(uint8_t flag);
         static void set_flag_set(uint8_t& flag, bool set);
         static void set_flag_ref(uint8_t& flag, bool ref);
         static void set_flag_editing(uint8_t& flag, bool editing);
         static void set_flag_deleted(uint8_t& flag, bool deleted);
+        static void set_flag_key_inline(uint8_t& flag, bool inline_key);
         static size_t item_size();
+        static size_t size_for(uint32_t capability);
         void update_key_count(uint32_t count);
         void update_updated_count(uint32_t count);
+        void update_tombstone_count(uint32_t count);
+        void update_live_key_bytes(uint64_t bytes);
+        void update_live_value_bytes(uint64_t bytes);
         void update_key_pos(uint64_t pos);
         void update_value_pos(uint64_t pos);
 
     private:
+        friend class UndoLog;
         void* start_;
         IndexMode mode_;
         size_t size_;
-        std::atomic<WriteInfo> write_info_;
+        size_t header_len_;
+        size_t item_size_;
+        // field offsets in an item, they depend on the format version.
+        size_t key_offset_;
+        size_t value_offset_;
+        size_t items_offset_;
+        uint8_t* ctrl_;
+        uint32_t version_;
+        uint32_t capability_;
+        uint32_t mask_;
+        uint64_t seed_;
+        // seqlocks of the items, odd while one of their items is written.
+        std::atomic<uint32_t> versions_[INDEX_VERSION_STRIPES];
+        UndoLog* undo_ = nullptr;
+        FreeSpace* free_space_ = nullptr;
+        size_t item_offset(uint32_t index) const;
+        std::atomic<uint32_t>& version_of(uint32_t index);
+        // a consistent copy of the item while writers may be changing it, the version it was copied at.
+        uint32_t copy_item(uint32_t index, uint8_t* item);
+        void begin_write(uint32_t index);
+        void end_write(uint32_t index);
+        static uint8_t ctrl_of(uint64_t hash);
+        uint32_t probe_start(uint64_t hash) const;
+        // true with the index of the key, else false and, with want_free, the first free index on
+        // its probe sequence, which is capability() when there is none.
+        bool find(Value* key_storage, Buf* key, uint64_t hash, uint32_t& index, bool want_free = false) const;
+        bool read_hashed(Value* key_storage, Value* value_storage, Buf* key, uint64_t hash, const ValueSink& sink);
+        // the item the lookup of hash most likely ends at, capability() when its first group has none.
+        uint32_t likely_item(uint64_t hash) const;
+        uint32_t find_empty(uint64_t hash) const;
+        void backup(uint32_t index);
+        void erase(uint32_t index);
+        // adds the storage bytes of a live item to the live bytes, or takes them off.
+        void count_item(const uint8_t* item, bool add);
+        bool move_item(Value* key_storage, Index* to, uint32_t index);
+        void insert_item(uint32_t index, uint64_t hash, const uint8_t* item);
+        const uint8_t* key_of(Value* key_storage, const uint8_t* item, uint8_t flag) const;
+        // the length of the value of item from value_len and, unless it is legacy, value_len_high.
+        uint64_t value_len_of(const uint8_t* item) const;
+        // writes both parts, only for an item of this version.
+        void set_value_len(uint8_t* item, uint64_t len) const;
+        bool key_equal(Value* key_storage, const uint8_t* item, uint8_t flag, Buf* key) const;
     };
 }
 
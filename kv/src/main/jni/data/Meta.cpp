@@ -4,20 +4,33 @@
 
 #include "Meta.h"
 
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include "../util/fs.h"
 
 namespace EmoKV {
     Meta::Meta(std::string& dir) :
             dir_(dir),
-            meta_path_(dir_ + "/meta") {
+            meta_path_(dir_ + "/meta"),
+            temp_path_(dir_ + "/meta.tmp"),
+            undo_path_(dir_ + "/undo"),
+            sorted_keys_path_(dir_ + "/sorted_keys"),
+            value_backup_path_(dir_ + "/value_backup") {
         std::ifstream meta_file;
         meta_file.open(meta_path_, std::ios::in);
         if (meta_file.is_open()) {
             getline(meta_file, index_path_);
             getline(meta_file, key_path_);
             getline(meta_file, value_path_);
+            // absent in the meta files written before incremental migration.
+            getline(meta_file, old_index_path_);
+            std::string shard_count;
+            if(getline(meta_file, shard_count) && !shard_count.empty()){
+                shard_count_ = static_cast<uint32_t>(strtoul(shard_count.c_str(), nullptr, 10));
+            }
             meta_file.close();
         }else{
             updateAllPath(dir_ + "/index_0", dir_ + "/key_0", dir_ + "/value_0");
@@ -38,6 +51,12 @@ namespace EmoKV {
         flush();
     }
 
+    void Meta::updateIndexPath(std::string path, std::string old_path) {
+        index_path_ = std::move(path);
+        old_index_path_ = std::move(old_path);
+        flush();
+    }
+
     void Meta::updateKeyPath(std::string path) {
         key_path_ = std::move(path);
         flush();
@@ -49,9 +68,15 @@ namespace EmoKV {
         flush();
     }
 
+    void Meta::updateShardCount(uint32_t count) {
+        shard_count_ = count;
+        flush();
+    }
+
+    // written aside and renamed over the meta: a crash in between leaves the previous one whole.
     void Meta::flush() {
         std::ofstream meta_file;
-        meta_file.open(meta_path_, std::ios::out | std::ios::trunc);
+        meta_file.open(temp_path_, std::ios::out | std::ios::trunc);
         if (meta_file.is_open()) {
             meta_file << index_path_;
             meta_file << "\n";
@@ -59,7 +84,14 @@ namespace EmoKV {
             meta_file << "\n";
             meta_file << value_path_;
             meta_file << "\n";
+            meta_file << old_index_path_;
+            meta_file << "\n";
+            meta_file << shard_count_;
+            meta_file << "\n";
             meta_file.close();
+            if (!meta_file.fail()) {
+                rename(temp_path_.c_str(), meta_path_.c_str());
+            }
         }
     }
 
@@ -75,6 +107,14 @@ namespace EmoKV {
         return index_path_;
     }
 
+    std::string &Meta::old_index_path() {
+        return old_index_path_;
+    }
+
+    uint32_t Meta::shard_count() const {
+        return shard_count_;
+    }
+
     std::string &Meta::key_path() {
         return key_path_;
     }
@@ -83,25 +123,45 @@ namespace EmoKV {
         return value_path_;
     }
 
-    std::string Meta::gen_value_path(std::string& dir) {
+    std::string &Meta::temp_path() {
+        return temp_path_;
+    }
+
+    std::string &Meta::undo_path() {
+        return undo_path_;
+    }
+
+    std::string &Meta::sorted_keys_path() {
+        return sorted_keys_path_;
+    }
+
+    std::string &Meta::value_backup_path() {
+        return value_backup_path_;
+    }
+
+    // file names are stamped with the current time, bumped until unused:
+    // two expansions can happen within the same millisecond.
+    static std::string gen_path(std::string& dir, const char* prefix) {
         const auto p1 = std::chrono::system_clock::now();
         auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
                 p1.time_since_epoch()).count();
-        return dir + "/value_" + std::to_string(time);
+        std::string path;
+        do {
+            path = dir + "/" + prefix + std::to_string(time++);
+        } while (isFileExist(path));
+        return path;
+    }
+
+    std::string Meta::gen_value_path(std::string& dir) {
+        return gen_path(dir, "value_");
     }
 
     std::string Meta::gen_key_path(std::string& dir) {
-        const auto p1 = std::chrono::system_clock::now();
-        auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
-                p1.time_since_epoch()).count();
-        return dir + "/key_" + std::to_string(time);
+        return gen_path(dir, "key_");
     }
 
     std::string Meta::gen_index_path(std::string &dir) {
-        const auto p1 = std::chrono::system_clock::now();
-        auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
-                p1.time_since_epoch()).count();
-        return dir + "/index_" + std::to_string(time);
+        return gen_path(dir, "index_");
     }
 
 }
\ No newline at end of file
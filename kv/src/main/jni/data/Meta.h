@@ -13,23 +13,42 @@ namespace EmoKV {
         ~Meta();
         void updateAllPath(std::string index, std::string key, std::string value);
         void updateIndexPath(std::string path);
+        // the index is being migrated from old_path, empty when the migration is done.
+        void updateIndexPath(std::string path, std::string old_path);
         void updateKeyPath(std::string path);
         void updateValuePath(std::string path);
+        void updateShardCount(uint32_t count);
 
         std::string& dir();
         std::string& meta_path();
+        // the next meta is written here first.
+        std::string& temp_path();
         std::string& index_path();
+        std::string& old_index_path();
         std::string& key_path();
         std::string& value_path();
+        // a fixed name, it's only ever rewritten in place.
+        std::string& undo_path();
+        std::string& sorted_keys_path();
+        // a fixed name as well, see ValueBackup.
+        std::string& value_backup_path();
+        // 0 when the store is not sharded, else its shards live in shard_<i> sub directories.
+        uint32_t shard_count() const;
         static std::string gen_index_path(std::string& dir);
         static std::string gen_key_path(std::string& dir);
         static std::string gen_value_path(std::string& dir);
     private:
         std::string dir_;
         std::string meta_path_;
+        std::string temp_path_;
         std::string index_path_;
+        std::string old_index_path_;
         std::string key_path_;
         std::string value_path_;
+        std::string undo_path_;
+        std::string sorted_keys_path_;
+        std::string value_backup_path_;
+        uint32_t shard_count_ = 0;
         size_t index_size;
         void flush();
     };
@@ -0,0 +1,314 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include "SortedKeys.h"
+#include "../util/fs.h"
+
+// Header(SORTED_KEYS_HEADER_LEN):
+// magic(4), state(4), count(4), reserved(4)
+//
+// then count offsets(4) of the entries from the start of the file, in key order,
+// then the entries: key_len(2):key
+#define SORTED_KEYS_HEADER_LEN 16
+#define SORTED_KEYS_MAGIC 0x59454B53
+
+namespace EmoKV {
+    static const size_t STATE_OFFSET = sizeof(uint32_t);
+    static const size_t COUNT_OFFSET = STATE_OFFSET + sizeof(uint32_t);
+
+    static const uint32_t STATE_DIRTY = 0;
+    static const uint32_t STATE_CLEAN = 1;
+
+    // the changes kept in memory before a merge, at least this many and a quarter of the file.
+    static const size_t MERGE_MIN_CHANGES = 1024;
+
+    static int compare(const uint8_t* a, size_t a_len, const uint8_t* b, size_t b_len){
+        int ret = memcmp(a, b, std::min(a_len, b_len));
+        if(ret != 0){
+            return ret;
+        }
+        return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+    }
+
+    static bool has_prefix(const uint8_t* key, size_t len, const uint8_t* prefix, size_t prefix_len){
+        return len >= prefix_len && memcmp(key, prefix, prefix_len) == 0;
+    }
+
+    SortedKeys::SortedKeys(const std::string& path, void* start, size_t size):
+    path_(path), start_(start), size_(size) {
+        memcpy(&count_, static_cast<uint8_t *>(start_) + COUNT_OFFSET, sizeof(uint32_t));
+        count_ = std::min<uint32_t>(count_, static_cast<uint32_t>((size_ - SORTED_KEYS_HEADER_LEN) / sizeof(uint32_t)));
+    }
+
+    SortedKeys* SortedKeys::open(const std::string& path, uint32_t key_count) {
+        if(!isFileExist(path)){
+            return nullptr;
+        }
+        size_t size;
+        void* start = make_mmap(path, SORTED_KEYS_HEADER_LEN, size);
+        if(start == nullptr){
+            return nullptr;
+        }
+        auto* s = static_cast<uint8_t *>(start);
+        uint32_t magic, state, count;
+        memcpy(&magic, s, sizeof(uint32_t));
+        memcpy(&state, s + STATE_OFFSET, sizeof(uint32_t));
+        memcpy(&count, s + COUNT_OFFSET, sizeof(uint32_t));
+        if(magic != SORTED_KEYS_MAGIC || state != STATE_CLEAN || count != key_count){
+            munmap(start, size);
+            return nullptr;
+        }
+        memcpy(s + STATE_OFFSET, &STATE_DIRTY, sizeof(uint32_t));
+        msync(start, SORTED_KEYS_HEADER_LEN, MS_SYNC);
+        return new SortedKeys(path, start, size);
+    }
+
+    SortedKeys* SortedKeys::build(const std::string& path, std::vector<std::string>& keys) {
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        size_t size;
+        void* start = write(path, keys, false, size);
+        if(start == nullptr){
+            return nullptr;
+        }
+        return new SortedKeys(path, start, size);
+    }
+
+    std::string SortedKeys::temp_path(const std::string& path) {
+        return path + ".tmp";
+    }
+
+    SortedKeys::~SortedKeys() {
+        // stays dirty if it fails: built again on the next open.
+        merge(true);
+        munmap(start_, size_);
+    }
+
+    bool SortedKeys::key_at(uint32_t i, const uint8_t*& key, size_t& len) const {
+        auto* s = static_cast<uint8_t *>(start_);
+        uint32_t offset;
+        memcpy(&offset, s + SORTED_KEYS_HEADER_LEN + i * sizeof(uint32_t), sizeof(uint32_t));
+        uint16_t key_len;
+        if(offset > size_ || size_ - offset < sizeof(uint16_t)){
+            return false;
+        }
+        memcpy(&key_len, s + offset, sizeof(uint16_t));
+        if(size_ - offset - sizeof(uint16_t) < key_len){
+            return false;
+        }
+        key = s + offset + sizeof(uint16_t);
+        len = key_len;
+        return true;
+    }
+
+    uint32_t SortedKeys::lower_bound(const uint8_t* key, size_t len) const {
+        uint32_t low = 0;
+        uint32_t high = count_;
+        while (low < high){
+            uint32_t mid = low + (high - low) / 2;
+            const uint8_t* mid_key = nullptr;
+            size_t mid_len = 0;
+            key_at(mid, mid_key, mid_len);
+            if(compare(mid_key, mid_len, key, len) < 0){
+                low = mid + 1;
+            }else{
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+    bool SortedKeys::file_contains(const uint8_t* key, size_t len) const {
+        uint32_t i = lower_bound(key, len);
+        const uint8_t* found = nullptr;
+        size_t found_len = 0;
+        return i < count_ && key_at(i, found, found_len) && compare(found, found_len, key, len) == 0;
+    }
+
+    bool SortedKeys::add(const uint8_t* key, size_t len) {
+        std::lock_guard<std::mutex> lock(lock_);
+        std::string k(reinterpret_cast<const char*>(key), len);
+        auto it = changes_.find(k);
+        if(it != changes_.end()){
+            it->second = true;
+        }else if(merging_ || !file_contains(key, len)){
+            changes_.emplace(std::move(k), true);
+        }
+        return wants_merge();
+    }
+
+    bool SortedKeys::remove(const uint8_t* key, size_t len) {
+        std::lock_guard<std::mutex> lock(lock_);
+        std::string k(reinterpret_cast<const char*>(key), len);
+        if(merging_ || file_contains(key, len)){
+            changes_[k] = false;
+        }else{
+            changes_.erase(k);
+        }
+        return wants_merge();
+    }
+
+    bool SortedKeys::wants_merge() const {
+        return changes_.size() > std::max<size_t>(MERGE_MIN_CHANGES, count_ / 4);
+    }
+
+    void SortedKeys::merge_changes() {
+        std::map<std::string, bool> changes;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            if(!wants_merge()){
+                return;
+            }
+            changes = changes_;
+            merging_ = true;
+        }
+        // only this call replaces the file, it can be read without the lock.
+        std::vector<std::string> keys;
+        merged_keys(changes, keys);
+        size_t size;
+        void* start = write(path_, keys, false, size);
+        std::lock_guard<std::mutex> lock(lock_);
+        merging_ = false;
+        if(start == nullptr){
+            return;
+        }
+        munmap(start_, size_);
+        start_ = start;
+        size_ = size;
+        count_ = static_cast<uint32_t>(keys.size());
+        // the file has the copied changes now, unless a key changed again meanwhile.
+        for(auto& change : changes){
+            auto it = changes_.find(change.first);
+            if(it != changes_.end() && it->second == change.second){
+                changes_.erase(it);
+            }
+        }
+    }
+
+    void SortedKeys::scan_prefix(const uint8_t* prefix, size_t len, std::vector<std::string>& keys) {
+        std::lock_guard<std::mutex> lock(lock_);
+        std::string p(reinterpret_cast<const char*>(prefix), len);
+        auto change = changes_.lower_bound(p);
+        uint32_t i = lower_bound(prefix, len);
+        const uint8_t* key = nullptr;
+        size_t key_len = 0;
+        bool in_file = i < count_ && key_at(i, key, key_len) && has_prefix(key, key_len, prefix, len);
+        while (true){
+            bool in_changes = change != changes_.end() && change->first.compare(0, len, p) == 0;
+            if(!in_file && !in_changes){
+                return;
+            }
+            int order = !in_changes ? -1 : (!in_file ? 1 : compare(
+                    key, key_len, reinterpret_cast<const uint8_t*>(change->first.data()), change->first.size()));
+            if(order >= 0){
+                // a change of the key overrides the file.
+                if(change->second){
+                    keys.push_back(change->first);
+                }
+                ++change;
+            }else{
+                keys.emplace_back(reinterpret_cast<const char*>(key), key_len);
+            }
+            if(order <= 0){
+                i++;
+                in_file = i < count_ && key_at(i, key, key_len) && has_prefix(key, key_len, prefix, len);
+            }
+        }
+    }
+
+    bool SortedKeys::merge(bool clean) {
+        if(changes_.empty()){
+            if(clean){
+                memcpy(static_cast<uint8_t *>(start_) + STATE_OFFSET, &STATE_CLEAN, sizeof(uint32_t));
+                msync(start_, SORTED_KEYS_HEADER_LEN, MS_SYNC);
+            }
+            return true;
+        }
+        std::vector<std::string> keys;
+        merged_keys(changes_, keys);
+        size_t size;
+        void* start = write(path_, keys, clean, size);
+        if(start == nullptr){
+            return false;
+        }
+        munmap(start_, size_);
+        start_ = start;
+        size_ = size;
+        count_ = static_cast<uint32_t>(keys.size());
+        changes_.clear();
+        return true;
+    }
+
+    void SortedKeys::merged_keys(const std::map<std::string, bool>& changes, std::vector<std::string>& keys) const {
+        keys.reserve(count_ + changes.size());
+        auto change = changes.begin();
+        uint32_t i = 0;
+        const uint8_t* key = nullptr;
+        size_t key_len = 0;
+        while (true){
+            bool in_file = false;
+            while (i < count_ && !(in_file = key_at(i, key, key_len))){
+                i++;
+            }
+            bool in_changes = change != changes.end();
+            if(!in_file && !in_changes){
+                break;
+            }
+            int order = !in_changes ? -1 : (!in_file ? 1 : compare(
+                    key, key_len, reinterpret_cast<const uint8_t*>(change->first.data()), change->first.size()));
+            if(order >= 0){
+                if(change->second){
+                    keys.push_back(change->first);
+                }
+                ++change;
+            }else{
+                keys.emplace_back(reinterpret_cast<const char*>(key), key_len);
+            }
+            if(order <= 0){
+                i++;
+            }
+        }
+    }
+
+    // written aside and renamed over the file, which is never seen half written.
+    void* SortedKeys::write(const std::string& path, const std::vector<std::string>& keys, bool clean, size_t& size) {
+        size_t total = SORTED_KEYS_HEADER_LEN + keys.size() * sizeof(uint32_t);
+        for(auto& key : keys){
+            total += sizeof(uint16_t) + key.size();
+        }
+        if(total > UINT32_MAX){
+            return nullptr;
+        }
+        std::string temp = temp_path(path);
+        std::remove(temp.c_str());
+        void* start = make_mmap(temp, total, size);
+        if(start == nullptr){
+            return nullptr;
+        }
+        auto* s = static_cast<uint8_t *>(start);
+        uint32_t magic = SORTED_KEYS_MAGIC;
+        uint32_t count = static_cast<uint32_t>(keys.size());
+        memcpy(s, &magic, sizeof(uint32_t));
+        memcpy(s + STATE_OFFSET, clean ? &STATE_CLEAN : &STATE_DIRTY, sizeof(uint32_t));
+        memcpy(s + COUNT_OFFSET, &count, sizeof(uint32_t));
+        auto offset = static_cast<uint32_t>(SORTED_KEYS_HEADER_LEN + keys.size() * sizeof(uint32_t));
+        for(size_t i = 0; i < keys.size(); i++){
+            memcpy(s + SORTED_KEYS_HEADER_LEN + i * sizeof(uint32_t), &offset, sizeof(uint32_t));
+            auto key_len = static_cast<uint16_t>(keys[i].size());
+            memcpy(s + offset, &key_len, sizeof(uint16_t));
+            memcpy(s + offset + sizeof(uint16_t), keys[i].data(), key_len);
+            offset += sizeof(uint16_t) + key_len;
+        }
+        msync(start, size, MS_SYNC);
+        if(rename(temp.c_str(), path.c_str()) != 0){
+            munmap(start, size);
+            return nullptr;
+        }
+        return start;
+    }
+}
@@ -0,0 +1,64 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#ifndef EMO_SORTED_KEYS_H
+#define EMO_SORTED_KEYS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace EmoKV {
+
+    // The keys of a store in byte order, for the prefix scans the hash index can't do: a sorted array
+    // of the keys in a file of its own, and the changes since in memory, merged into a new file once
+    // they grow to a part of it. The merge is left to the caller, off the writers' path. The file is marked dirty as soon as it's opened and clean again when
+    // it's closed, a store that died in between builds it from its index again.
+    class SortedKeys {
+    public:
+        // null when the file at path is missing, dirty, or holds another count of keys than key_count.
+        static SortedKeys* open(const std::string& path, uint32_t key_count);
+        // a new file with the keys, which come in any order.
+        static SortedKeys* build(const std::string& path, std::vector<std::string>& keys);
+        static std::string temp_path(const std::string& path);
+        // merges the changes and marks the file clean.
+        ~SortedKeys();
+        // both return true once the changes call for merge_changes.
+        bool add(const uint8_t* key, size_t len);
+        bool remove(const uint8_t* key, size_t len);
+        // writes the file again with the changes in it. the changes are copied under the lock, add, remove
+        // and scan_prefix go on while the file is written. one call at a time.
+        void merge_changes();
+        // appends the keys that start with prefix to keys, in order.
+        void scan_prefix(const uint8_t* prefix, size_t len, std::vector<std::string>& keys);
+
+    private:
+        SortedKeys(const std::string& path, void* start, size_t size);
+        std::string path_;
+        void* start_;
+        size_t size_;
+        uint32_t count_;
+        // true for a key added since the file was written, false for one removed.
+        std::map<std::string, bool> changes_;
+        // while merge_changes writes the file, changes are kept whatever the file holds: it's replaced.
+        bool merging_ = false;
+        std::mutex lock_;
+        bool wants_merge() const;
+        // the keys of the file with changes applied, in order.
+        void merged_keys(const std::map<std::string, bool>& changes, std::vector<std::string>& keys) const;
+        // false for an entry that is out of the file, which is then treated as empty.
+        bool key_at(uint32_t i, const uint8_t*& key, size_t& len) const;
+        // the first entry not below the key.
+        uint32_t lower_bound(const uint8_t* key, size_t len) const;
+        bool file_contains(const uint8_t* key, size_t len) const;
+        // rewrites the file with the changes in it, it stays dirty unless clean.
+        bool merge(bool clean);
+        static void* write(const std::string& path, const std::vector<std::string>& keys, bool clean, size_t& size);
+    };
+}
+
+#endif //EMO_SORTED_KEYS_H
@@ -0,0 +1,148 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#include <atomic>
+#include <cstring>
+#include <sys/mman.h>
+#include "UndoLog.h"
+#include "Index.h"
+
+// Header(UNDO_HEADER_LEN):
+// magic(4), state(4), count(4), has_old_index(4)
+// index_header(INDEX_HEADER_LEN), old_index_header(INDEX_HEADER_LEN)
+//
+// Entry(count of them):
+// tag(1):ctrl(1):item_index(4):item(Index::item_size())
+// tag is 0 for the index, 1 for the index being migrated from, the meta names both of them.
+//
+// Every entry and header is written before count/state mark it valid, and the index is only
+// changed after its entry is valid. A rollback writes the same bytes again, so a crash in it is fine.
+#define UNDO_HEADER_LEN 16
+#define UNDO_MAGIC 0x4F444E55
+
+namespace EmoKV {
+    static const size_t STATE_OFFSET = sizeof(uint32_t);
+    static const size_t COUNT_OFFSET = STATE_OFFSET + sizeof(uint32_t);
+    static const size_t HAS_OLD_OFFSET = COUNT_OFFSET + sizeof(uint32_t);
+    static const size_t INDEX_HEADERS_OFFSET = UNDO_HEADER_LEN;
+    static const size_t ENTRIES_OFFSET = INDEX_HEADERS_OFFSET + INDEX_HEADER_LEN * 2;
+
+    static const uint32_t STATE_IDLE = 0;
+    static const uint32_t STATE_PENDING = 1;
+
+    // the stores of the log must reach the mapping before the ones to the index they cover.
+    static void order(){
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+
+    UndoLog::UndoLog(void* start, size_t size): start_(start), size_(size){
+        auto* s = static_cast<uint8_t *>(start_);
+        capability_ = size_ > ENTRIES_OFFSET ? static_cast<uint32_t>((size_ - ENTRIES_OFFSET) / entry_size()) : 0;
+        uint32_t magic;
+        memcpy(&magic, s, sizeof(uint32_t));
+        if(magic != UNDO_MAGIC){
+            magic = UNDO_MAGIC;
+            memset(s, 0, UNDO_HEADER_LEN);
+            memcpy(s, &magic, sizeof(uint32_t));
+        }
+    }
+
+    UndoLog::~UndoLog() {
+        munmap(start_, size_);
+    }
+
+    size_t UndoLog::entry_size() {
+        return sizeof(uint8_t) * 2 + sizeof(uint32_t) + Index::item_size();
+    }
+
+    size_t UndoLog::size_for(uint32_t capability) {
+        return ENTRIES_OFFSET + capability * entry_size();
+    }
+
+    uint32_t UndoLog::capability() const {
+        return capability_;
+    }
+
+    bool UndoLog::is_pending() const {
+        uint32_t state;
+        memcpy(&state, static_cast<uint8_t *>(start_) + STATE_OFFSET, sizeof(uint32_t));
+        return state == STATE_PENDING;
+    }
+
+    uint32_t UndoLog::count() const {
+        uint32_t count;
+        memcpy(&count, static_cast<uint8_t *>(start_) + COUNT_OFFSET, sizeof(uint32_t));
+        return count < capability_ ? count : capability_;
+    }
+
+    uint8_t* UndoLog::entry(uint32_t i) const {
+        return static_cast<uint8_t *>(start_) + ENTRIES_OFFSET + i * entry_size();
+    }
+
+    void UndoLog::begin(Index* index, Index* old_index) {
+        auto* s = static_cast<uint8_t *>(start_);
+        old_index_ = old_index;
+        memcpy(s + INDEX_HEADERS_OFFSET, index->start_, INDEX_HEADER_LEN);
+        if(old_index != nullptr){
+            memcpy(s + INDEX_HEADERS_OFFSET + INDEX_HEADER_LEN, old_index->start_, INDEX_HEADER_LEN);
+        }
+        uint32_t count = 0;
+        uint32_t has_old = old_index != nullptr ? 1 : 0;
+        memcpy(s + COUNT_OFFSET, &count, sizeof(uint32_t));
+        memcpy(s + HAS_OLD_OFFSET, &has_old, sizeof(uint32_t));
+        order();
+        memcpy(s + STATE_OFFSET, &STATE_PENDING, sizeof(uint32_t));
+        order();
+    }
+
+    void UndoLog::save(Index* from, uint32_t item) {
+        uint32_t i = count();
+        if(i == capability_){
+            // sized by the caller for the batch, never hit.
+            return;
+        }
+        uint8_t* e = entry(i);
+        e[0] = from == old_index_ ? 1 : 0;
+        e[1] = from->ctrl_[item];
+        memcpy(e + sizeof(uint8_t) * 2, &item, sizeof(uint32_t));
+        memcpy(e + sizeof(uint8_t) * 2 + sizeof(uint32_t),
+               static_cast<uint8_t *>(from->start_) + from->item_offset(item), from->item_size_);
+        order();
+        i++;
+        memcpy(static_cast<uint8_t *>(start_) + COUNT_OFFSET, &i, sizeof(uint32_t));
+        order();
+    }
+
+    void UndoLog::end() {
+        order();
+        memcpy(static_cast<uint8_t *>(start_) + STATE_OFFSET, &STATE_IDLE, sizeof(uint32_t));
+        old_index_ = nullptr;
+    }
+
+    void UndoLog::rollback(Index* index, Index* old_index) {
+        auto* s = static_cast<uint8_t *>(start_);
+        for(uint32_t i = count(); i > 0; i--){
+            uint8_t* e = entry(i - 1);
+            Index* to = e[0] == 1 ? old_index : index;
+            uint32_t item;
+            memcpy(&item, e + sizeof(uint8_t) * 2, sizeof(uint32_t));
+            if(to == nullptr || item >= to->capability()){
+                continue;
+            }
+            // readers may be looking at the item, it's written like any other write.
+            to->begin_write(item);
+            memcpy(static_cast<uint8_t *>(to->start_) + to->item_offset(item),
+                   e + sizeof(uint8_t) * 2 + sizeof(uint32_t), to->item_size_);
+            to->ctrl_[item] = e[1];
+            to->end_write(item);
+        }
+        uint32_t has_old;
+        memcpy(&has_old, s + HAS_OLD_OFFSET, sizeof(uint32_t));
+        memcpy(index->start_, s + INDEX_HEADERS_OFFSET, INDEX_HEADER_LEN);
+        if(old_index != nullptr && has_old == 1){
+            memcpy(old_index->start_, s + INDEX_HEADERS_OFFSET + INDEX_HEADER_LEN, INDEX_HEADER_LEN);
+        }
+        end();
+    }
+}
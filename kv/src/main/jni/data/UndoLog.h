@@ -0,0 +1,45 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#ifndef EMO_UNDO_LOG_H
+#define EMO_UNDO_LOG_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace EmoKV {
+    class Index;
+
+    // Makes a batch of index writes atomic across crashes, the way the backup item in the index
+    // header does for a single one: the headers and every item are saved here before they change,
+    // and a batch that didn't end is rolled back on open. The storages need nothing of this, a batch
+    // only writes to them where no item points.
+    class UndoLog {
+    public:
+        UndoLog(void* start, size_t size);
+        ~UndoLog();
+        static size_t size_for(uint32_t capability);
+        // the count of item writes a batch can save.
+        uint32_t capability() const;
+        // a batch began and didn't end: the process died in it.
+        bool is_pending() const;
+        // saves the headers, old_index may be null. the indexes then save their items through set_undo.
+        void begin(Index* index, Index* old_index);
+        void save(Index* from, uint32_t item);
+        void end();
+        // puts back what was saved since begin, latest first, and ends the batch.
+        void rollback(Index* index, Index* old_index);
+
+    private:
+        void* start_;
+        size_t size_;
+        uint32_t capability_;
+        Index* old_index_ = nullptr;
+        uint32_t count() const;
+        uint8_t* entry(uint32_t i) const;
+        static size_t entry_size();
+    };
+}
+
+#endif //EMO_UNDO_LOG_H
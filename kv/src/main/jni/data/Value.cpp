@@ -2,20 +2,34 @@
 // Created by cgspi on 2022/12/31.
 //
 
+#include <cstdlib>
 #include <cstring>
 #include <memory>
 #include <sys/mman.h>
 #include "Value.h"
+#include "../util/fs.h"
 
 namespace EmoKV {
-    Value::Value(void *start, size_t size):
+    Value::Value(void *start, size_t size, size_t reserved):
     start_(start),
-    size_(size) {
+    size_(size),
+    reserved_(reserved) {
 
     }
 
     Value::~Value(){
-        munmap(start_, size_);
+        munmap(start_, std::max(reserved_, size_.load()));
+    }
+
+    bool Value::grow(const std::string& path, size_t size) {
+        size_t last = size_.load();
+        size = page_round(size);
+        if(size > reserved_ || !grow_mmap(path, start_, last, size)){
+            return false;
+        }
+        // the pages are mapped before any reader can see them in.
+        size_.store(size, std::memory_order_release);
+        return true;
     }
 
     std::unique_ptr<Buf> Value::get(uint64_t offset, size_t len){
@@ -24,8 +38,28 @@ namespace EmoKV {
         std::unique_ptr<Buf> ret(new Buf(data, len, true));
         return ret;
     }
+    const uint8_t* Value::view(uint64_t offset) const{
+        return static_cast<uint8_t *>(start_) + offset;
+    }
+
+    uint8_t* Value::mutable_view(uint64_t offset) const{
+        return static_cast<uint8_t *>(start_) + offset;
+    }
+
+    bool Value::contains(uint64_t offset, size_t len) const{
+        size_t size = size_.load(std::memory_order_acquire);
+        return offset <= size && len <= size - offset;
+    }
+
+    bool Value::equal(uint64_t offset, size_t len, Buf* buf) const{
+        if(buf->len() != len || !contains(offset, len)){
+            return false;
+        }
+        return memcmp(static_cast<uint8_t *>(start_) + offset, buf->ptr(), len) == 0;
+    }
+
     int Value::put(uint64_t offset, const uint8_t* data, size_t len) const{
-        if(offset + len > size_){
+        if(offset + len > size_.load(std::memory_order_acquire)){
             return -1;
         }
         memcpy(static_cast<uint8_t *>(start_) + offset, data, len);
@@ -37,7 +71,7 @@ namespace EmoKV {
     }
 
     size_t  Value::size() const{
-        return size_;
+        return size_.load(std::memory_order_acquire);
     }
 
 }
\ No newline at end of file
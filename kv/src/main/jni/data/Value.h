@@ -5,24 +5,38 @@
 #ifndef EMO_VALUE_H
 #define EMO_VALUE_H
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <string>
 #include "../Buf.h"
 
 namespace EmoKV {
     class Value {
     public:
-        Value(void* start, size_t size);
+        // reserved is the address space at start that the mapping may grow in, see make_reserved_mmap.
+        Value(void* start, size_t size, size_t reserved = 0);
         ~Value();
+        // maps the file at path up to size in place, false when that's past the reserved space. the
+        // pointers into the mapping stay valid, and readers may go on meanwhile. one grows at a time.
+        bool grow(const std::string& path, size_t size);
 
         std::unique_ptr<Buf> get(uint64_t offset, size_t len);
+        // non-owning view into the mapping, valid as long as this Value.
+        const uint8_t* view(uint64_t offset) const;
+        // the same for the writer that placed the bytes there.
+        uint8_t* mutable_view(uint64_t offset) const;
+        bool contains(uint64_t offset, size_t len) const;
+        bool equal(uint64_t offset, size_t len, Buf* buf) const;
         int put(uint64_t offset, const uint8_t* data, size_t len) const;
         void copy_to(Value* target, uint64_t src, uint64_t dst, size_t len);
         size_t  size() const;
 
     private:
         void* start_;
-        size_t size_;
+        std::atomic<size_t> size_;
+        size_t reserved_;
     };
 }
 
@@ -0,0 +1,101 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#include <atomic>
+#include <cstring>
+#include <sys/mman.h>
+#include "ValueBackup.h"
+#include "Index.h"
+
+// Header(VALUE_BACKUP_HEADER_LEN):
+// magic(4), state(4), is_old(4), item(4), pos(8), len(4), value_len(4)
+// then the len saved bytes.
+//
+// The bytes and the header are written before state marks them valid, and the storage is only
+// overwritten after. A rollback writes the same bytes again, so a crash in it is fine.
+#define VALUE_BACKUP_HEADER_LEN 32
+#define VALUE_BACKUP_MAGIC 0x4B504256
+
+namespace EmoKV {
+    static const size_t STATE_OFFSET = sizeof(uint32_t);
+    static const size_t IS_OLD_OFFSET = STATE_OFFSET + sizeof(uint32_t);
+    static const size_t ITEM_OFFSET = IS_OLD_OFFSET + sizeof(uint32_t);
+    static const size_t POS_OFFSET = ITEM_OFFSET + sizeof(uint32_t);
+    static const size_t LEN_OFFSET = POS_OFFSET + sizeof(uint64_t);
+    static const size_t VALUE_LEN_OFFSET = LEN_OFFSET + sizeof(uint32_t);
+
+    static const uint32_t STATE_IDLE = 0;
+    static const uint32_t STATE_PENDING = 1;
+
+    // the stores of the backup must reach the mapping before the ones to the storage they cover.
+    static void order(){
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+
+    ValueBackup::ValueBackup(void* start, size_t size): start_(start), size_(size){
+        auto* s = static_cast<uint8_t *>(start_);
+        uint32_t magic;
+        memcpy(&magic, s, sizeof(uint32_t));
+        if(magic != VALUE_BACKUP_MAGIC){
+            magic = VALUE_BACKUP_MAGIC;
+            memset(s, 0, VALUE_BACKUP_HEADER_LEN);
+            memcpy(s, &magic, sizeof(uint32_t));
+        }
+    }
+
+    ValueBackup::~ValueBackup() {
+        munmap(start_, size_);
+    }
+
+    size_t ValueBackup::size_for() {
+        return VALUE_BACKUP_HEADER_LEN + UINT16_MAX;
+    }
+
+    bool ValueBackup::is_pending() const {
+        uint32_t state;
+        memcpy(&state, static_cast<uint8_t *>(start_) + STATE_OFFSET, sizeof(uint32_t));
+        return state == STATE_PENDING;
+    }
+
+    void ValueBackup::begin(bool is_old, uint32_t item, Value* storage, uint64_t pos, size_t len, uint16_t value_len) {
+        auto* s = static_cast<uint8_t *>(start_);
+        uint32_t old = is_old ? 1 : 0;
+        auto saved = static_cast<uint32_t>(len);
+        uint32_t item_len = value_len;
+        memcpy(s + IS_OLD_OFFSET, &old, sizeof(uint32_t));
+        memcpy(s + ITEM_OFFSET, &item, sizeof(uint32_t));
+        memcpy(s + POS_OFFSET, &pos, sizeof(uint64_t));
+        memcpy(s + LEN_OFFSET, &saved, sizeof(uint32_t));
+        memcpy(s + VALUE_LEN_OFFSET, &item_len, sizeof(uint32_t));
+        memcpy(s + VALUE_BACKUP_HEADER_LEN, storage->view(pos), len);
+        order();
+        memcpy(s + STATE_OFFSET, &STATE_PENDING, sizeof(uint32_t));
+        order();
+    }
+
+    void ValueBackup::end() {
+        order();
+        memcpy(static_cast<uint8_t *>(start_) + STATE_OFFSET, &STATE_IDLE, sizeof(uint32_t));
+    }
+
+    void ValueBackup::rollback(Index* index, Index* old_index, Value* storage) {
+        auto* s = static_cast<uint8_t *>(start_);
+        uint32_t is_old;
+        uint32_t item;
+        uint64_t pos;
+        uint32_t len;
+        uint32_t value_len;
+        memcpy(&is_old, s + IS_OLD_OFFSET, sizeof(uint32_t));
+        memcpy(&item, s + ITEM_OFFSET, sizeof(uint32_t));
+        memcpy(&pos, s + POS_OFFSET, sizeof(uint64_t));
+        memcpy(&len, s + LEN_OFFSET, sizeof(uint32_t));
+        memcpy(&value_len, s + VALUE_LEN_OFFSET, sizeof(uint32_t));
+        Index* to = is_old == 1 ? old_index : index;
+        if(to != nullptr && len <= UINT16_MAX && storage->contains(pos, len)){
+            storage->put(pos, s + VALUE_BACKUP_HEADER_LEN, len);
+            to->restore_value_len(item, pos, static_cast<uint16_t>(value_len));
+        }
+        end();
+    }
+}
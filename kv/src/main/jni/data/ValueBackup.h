@@ -0,0 +1,38 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#ifndef EMO_VALUE_BACKUP_H
+#define EMO_VALUE_BACKUP_H
+
+#include <cstddef>
+#include <cstdint>
+#include "Value.h"
+
+namespace EmoKV {
+    class Index;
+
+    // Makes a value written over the one of its item in the value storage atomic across crashes: the
+    // bytes it overwrites and the length of the item are saved here first, and an overwrite that
+    // didn't end is put back on open. The backup item in the index header covers the item itself.
+    class ValueBackup {
+    public:
+        ValueBackup(void* start, size_t size);
+        ~ValueBackup();
+        // enough for any value written in place, which is up to UINT16_MAX bytes, see KV::overwrite.
+        static size_t size_for();
+        bool is_pending() const;
+        // saves len bytes of storage at pos, which the value of item is going to overwrite. the item has
+        // value_len then, in the index or in the one being migrated from when is_old.
+        void begin(bool is_old, uint32_t item, Value* storage, uint64_t pos, size_t len, uint16_t value_len);
+        void end();
+        // puts the bytes and the value length of the item back, and ends.
+        void rollback(Index* index, Index* old_index, Value* storage);
+
+    private:
+        void* start_;
+        size_t size_;
+    };
+}
+
+#endif //EMO_VALUE_BACKUP_H
@@ -4,14 +4,18 @@
 
 #ifndef EMO_FS_H
 #define EMO_FS_H
+#include <algorithm>
+#include <cstdint>
 #include <string>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 namespace EmoKV {
 
-    static bool isFileExist(const std::string& path){
+    inline bool isFileExist(const std::string& path){
         if (path.empty()) {
             return false;
         }
@@ -19,7 +23,7 @@ namespace EmoKV {
         return lstat(path.c_str(), &st) == 0;
     }
 
-    static size_t getFileSize(int fd) {
+    inline size_t getFileSize(int fd) {
         struct stat st = {};
         if (fstat(fd, &st) != -1) {
             return (size_t) st.st_size;
@@ -27,7 +31,7 @@ namespace EmoKV {
         return -1;
     }
 
-    static void* make_mmap(const std::string& path, size_t mini_space, size_t& size){
+    inline void* make_mmap(const std::string& path, size_t mini_space, size_t& size){
         auto fd = open(path.c_str(), O_RDWR | O_CREAT, S_IRWXU);
         if(fd == -1){
             return nullptr;
@@ -45,5 +49,63 @@ namespace EmoKV {
         size = file_len;
         return start;
     }
+
+    inline size_t page_round(size_t size){
+        auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return (size + page - 1) / page * page;
+    }
+
+    // maps the file at path like make_mmap, at the start of reserve bytes of address space that grow_mmap
+    // maps more of the file in later. reserved is 0 when the space can't be had, then only the file is mapped.
+    inline void* make_reserved_mmap(const std::string& path, size_t mini_space, size_t reserve, size_t& size,
+                                    size_t& reserved){
+        auto fd = open(path.c_str(), O_RDWR | O_CREAT, S_IRWXU);
+        if(fd == -1){
+            return nullptr;
+        }
+        size_t file_len = getFileSize(fd);
+        // the file ends on a page, so that growing it only maps the pages after.
+        size_t len = page_round(std::max(file_len, mini_space));
+        if(file_len < len && ftruncate(fd, static_cast<off_t>(len)) != 0){
+            close(fd);
+            return nullptr;
+        }
+        void* start = MAP_FAILED;
+        reserved = 0;
+        if(reserve > len){
+            void* space = mmap(nullptr, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if(space != MAP_FAILED){
+                start = mmap(space, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+                if(start == MAP_FAILED){
+                    munmap(space, reserve);
+                }else{
+                    reserved = reserve;
+                }
+            }
+        }
+        if(start == MAP_FAILED){
+            start = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if(start == MAP_FAILED){
+            return nullptr;
+        }
+        size = len;
+        return start;
+    }
+
+    // grows the file at path to new_size and maps the part past size right after the mapping at start,
+    // over the space make_reserved_mmap reserved. both sizes are on pages.
+    inline bool grow_mmap(const std::string& path, void* start, size_t size, size_t new_size){
+        auto fd = open(path.c_str(), O_RDWR);
+        if(fd == -1){
+            return false;
+        }
+        bool ret = (getFileSize(fd) >= new_size || ftruncate(fd, static_cast<off_t>(new_size)) == 0) &&
+                mmap(static_cast<uint8_t *>(start) + size, new_size - size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_FIXED, fd, static_cast<off_t>(size)) != MAP_FAILED;
+        close(fd);
+        return ret;
+    }
 }
 #endif //EMO_FS_H
@@ -0,0 +1,59 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#ifndef EMO_GROUP_H
+#define EMO_GROUP_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// Compares a group of GROUP_WIDTH control bytes against one byte at once,
+// bit i of the result is set when ctrl[i] == byte.
+namespace EmoKV {
+
+    static const uint32_t GROUP_WIDTH = 16;
+
+    static inline uint32_t group_match(const uint8_t* ctrl, uint8_t byte){
+#if defined(__SSE2__)
+        __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl));
+        __m128i cmp = _mm_cmpeq_epi8(group, _mm_set1_epi8(static_cast<char>(byte)));
+        return static_cast<uint32_t>(_mm_movemask_epi8(cmp));
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        // no movemask in NEON: keep one bit per lane and fold the lanes with pairwise adds.
+        static const uint8_t lane_bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+        uint8x16_t cmp = vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(byte));
+        uint8x16_t bits = vandq_u8(cmp, vld1q_u8(lane_bits));
+        uint8x8_t low = vget_low_u8(bits);
+        uint8x8_t high = vget_high_u8(bits);
+        low = vpadd_u8(low, low);
+        low = vpadd_u8(low, low);
+        low = vpadd_u8(low, low);
+        high = vpadd_u8(high, high);
+        high = vpadd_u8(high, high);
+        high = vpadd_u8(high, high);
+        return static_cast<uint32_t>(vget_lane_u8(low, 0)) | (static_cast<uint32_t>(vget_lane_u8(high, 0)) << 8);
+#else
+        uint32_t mask = 0;
+        for(uint32_t i = 0; i < GROUP_WIDTH; i++){
+            if(ctrl[i] == byte){
+                mask |= 1u << i;
+            }
+        }
+        return mask;
+#endif
+    }
+
+    // index of the lowest set bit, mask must not be 0.
+    static inline uint32_t group_first(uint32_t mask){
+        return static_cast<uint32_t>(__builtin_ctz(mask));
+    }
+}
+
+#endif //EMO_GROUP_H
@@ -0,0 +1,102 @@
+//
+// Created by cgspi on 2026/10/16.
+//
+
+#ifndef EMO_HASH_H
+#define EMO_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Seeded word-at-a-time hash, a port of wyhash (final 4, public domain).
+// Hashes are only stored alongside the data they were computed on, so the
+// native byte order is fine.
+namespace EmoKV {
+
+    static const uint64_t WY_P0 = 0xa0761d6478bd642full;
+    static const uint64_t WY_P1 = 0xe7037ed1a0b428dbull;
+    static const uint64_t WY_P2 = 0x8ebc6af09c88c6e3ull;
+    static const uint64_t WY_P3 = 0x589965cc75374cc3ull;
+
+    static inline uint64_t wy_read8(const uint8_t* p){
+        uint64_t v;
+        memcpy(&v, p, sizeof(uint64_t));
+        return v;
+    }
+
+    static inline uint64_t wy_read4(const uint8_t* p){
+        uint32_t v;
+        memcpy(&v, p, sizeof(uint32_t));
+        return v;
+    }
+
+    static inline uint64_t wy_read3(const uint8_t* p, size_t k){
+        return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+    }
+
+    static inline void wy_mum(uint64_t* a, uint64_t* b){
+#if defined(__SIZEOF_INT128__)
+        __uint128_t r = *a;
+        r *= *b;
+        *a = static_cast<uint64_t>(r);
+        *b = static_cast<uint64_t>(r >> 64);
+#else
+        // armeabi-v7a has no 128 bits multiply.
+        uint64_t ha = *a >> 32, hb = *b >> 32, la = static_cast<uint32_t>(*a), lb = static_cast<uint32_t>(*b);
+        uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+        uint64_t t = rl + (rm0 << 32), c = t < rl;
+        uint64_t lo = t + (rm1 << 32);
+        c += lo < t;
+        *a = lo;
+        *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+    }
+
+    static inline uint64_t wy_mix(uint64_t a, uint64_t b){
+        wy_mum(&a, &b);
+        return a ^ b;
+    }
+
+    static inline uint64_t hash_bytes(const uint8_t* p, size_t len, uint64_t seed){
+        seed ^= wy_mix(seed ^ WY_P0, WY_P1);
+        uint64_t a, b;
+        if(len <= 16){
+            if(len >= 4){
+                a = (wy_read4(p) << 32) | wy_read4(p + ((len >> 3) << 2));
+                b = (wy_read4(p + len - 4) << 32) | wy_read4(p + len - 4 - ((len >> 3) << 2));
+            }else if(len > 0){
+                a = wy_read3(p, len);
+                b = 0;
+            }else{
+                a = b = 0;
+            }
+        }else{
+            size_t i = len;
+            if(i > 48){
+                uint64_t see1 = seed, see2 = seed;
+                do {
+                    seed = wy_mix(wy_read8(p) ^ WY_P1, wy_read8(p + 8) ^ seed);
+                    see1 = wy_mix(wy_read8(p + 16) ^ WY_P2, wy_read8(p + 24) ^ see1);
+                    see2 = wy_mix(wy_read8(p + 32) ^ WY_P3, wy_read8(p + 40) ^ see2);
+                    p += 48;
+                    i -= 48;
+                } while (i > 48);
+                seed ^= see1 ^ see2;
+            }
+            while (i > 16){
+                seed = wy_mix(wy_read8(p) ^ WY_P1, wy_read8(p + 8) ^ seed);
+                i -= 16;
+                p += 16;
+            }
+            a = wy_read8(p + i - 16);
+            b = wy_read8(p + i - 8);
+        }
+        a ^= WY_P1;
+        b ^= seed;
+        wy_mum(&a, &b);
+        return wy_mix(a ^ WY_P0 ^ len, b ^ WY_P1);
+    }
+}
+
+#endif //EMO_HASH_H
@@ -31,6 +31,14 @@ namespace EmoKV {
         return jstringToString(env, fieldValue);
     }
 
+    static void throwException(JNIEnv *env, const char *className, const std::string &msg) {
+        jclass cls = env->FindClass(className);
+        if(cls){
+            env->ThrowNew(cls, msg.c_str());
+            env->DeleteLocalRef(cls);
+        }
+    }
+
     static int intFieldValue(JNIEnv *env, jobject intance, const char *fieldName) {
         jclass cls = env->GetObjectClass(intance);
         jfieldID field = env->GetFieldID(cls, fieldName, "I");
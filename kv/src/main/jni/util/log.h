@@ -2,15 +2,22 @@
 #define EMO_LOG_H
 
 
+#ifdef __ANDROID__
 #include <android/log.h>
+#endif
 
 #ifndef TAG
 #define TAG "EmoKV"
 #endif
 
 #ifndef LOG
+#ifdef __ANDROID__
 #define LOG(priority, tag, ...) \
     __android_log_print(ANDROID_##priority, tag, __VA_ARGS__)
+#else
+// the host build of EmoKVCore has no logcat, the logs are dropped.
+#define LOG(priority, tag, ...) 0
+#endif
 #endif
 
 #ifndef LOG_V